@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "atlas.h"
+
+Atlas::Atlas(int width, int height, int pad) {
+    page_width = width;
+    page_height = height;
+    padding = pad;
+    bytes = 0;
+}
+
+int Atlas::add(const char* path) {
+    size_t width, height;
+    char* pixels = load_png_image(path, &width, &height);
+
+    try {
+        int index = add(path, pixels, width, height);
+        free(pixels);
+        return index;
+    } catch( ... ) {
+        free(pixels);
+        throw;
+    }
+}
+
+int Atlas::add(const std::string& name, const char* pixels, size_t width, size_t height) {
+    image_t image;
+    image.name = name;
+    image.pixels.assign(pixels, pixels + width * height * 4);
+    memset(&image.region, 0, sizeof(image.region));
+    image.region.width = width;
+    image.region.height = height;
+
+    std::lock_guard<std::mutex> guard(lock);
+    images.push_back(std::move(image));
+    return images.size() - 1;
+}
+
+/* Can a rectangle stand on the skyline starting at given node. Gets the lowest y it can stand at */
+bool Atlas::fit(const page_t& page, size_t node, int width, int height, int* y) {
+    int x = page.skyline[node].x;
+    if( x + width > page_width ) return false;
+
+    *y = page.skyline[node].y;
+    for( int left = width; left > 0; left -= page.skyline[node++].width ) {
+        *y = std::max(*y, page.skyline[node].y);
+        if( *y + height > page_height ) return false;
+    }
+    return true;
+}
+
+/* Put rectangle as low as possible, then as far left as possible, and raise the skyline under it */
+bool Atlas::place(page_t& page, int width, int height, int* x, int* y) {
+    int best = -1, best_top = 0;
+    for( size_t i = 0; i < page.skyline.size(); ++i ) {
+        int top;
+        if( ! fit(page, i, width, height, &top) ) continue;
+
+        if( best < 0 || top < best_top ) {
+            best = i;
+            best_top = top;
+        }
+    }
+    if( best < 0 ) return false;
+
+    *x = page.skyline[best].x;
+    *y = best_top;
+
+    skyline_t node = { *x, best_top + height, width };
+    page.skyline.insert(page.skyline.begin() + best, node);
+
+    /* Nodes under the new one are cut or removed */
+    for( size_t i = best + 1; i < page.skyline.size(); ) {
+        skyline_t& previous = page.skyline[i - 1];
+        skyline_t& current = page.skyline[i];
+        int overlap = previous.x + previous.width - current.x;
+        if( overlap <= 0 ) break;
+
+        current.x += overlap;
+        current.width -= overlap;
+        if( current.width > 0 ) break;
+        page.skyline.erase(page.skyline.begin() + i);
+    }
+
+    /* Neighbours of the same height become one */
+    for( size_t i = 0; i + 1 < page.skyline.size(); ) {
+        if( page.skyline[i].y == page.skyline[i + 1].y ) {
+            page.skyline[i].width += page.skyline[i + 1].width;
+            page.skyline.erase(page.skyline.begin() + i + 1);
+        }
+        else ++i;
+    }
+
+    page.used_height = std::max(page.used_height, best_top + height);
+    return true;
+}
+
+/* Copy image into its padded place, padding repeats image edges */
+void Atlas::copy(page_t& page, const image_t& image, int x, int y) {
+    int width = image.region.width;
+    int height = image.region.height;
+    size_t page_stride = page_width * 4;
+    const char* src = image.pixels.data();
+
+    for( int row = -padding; row < height + padding; ++row ) {
+        const char* src_row = src + std::min(std::max(row, 0), height - 1) * width * 4;
+        char* dst = page.pixels.data() + (y + padding + row) * page_stride + x * 4;
+
+        for( int i = 0; i < padding; ++i ) memcpy(dst + i * 4, src_row, 4);
+        memcpy(dst + padding * 4, src_row, width * 4);
+        for( int i = 0; i < padding; ++i ) memcpy(dst + (padding + width + i) * 4, src_row + (width - 1) * 4, 4);
+    }
+}
+
+void Atlas::upload(const texture_options_t& options) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    /* Tallest images first pack best. Names keep the order stable */
+    std::vector<size_t> order(images.size());
+    for( size_t i = 0; i < order.size(); ++i ) order[i] = i;
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        const image_t& ia = images[a];
+        const image_t& ib = images[b];
+        if( ia.region.height != ib.region.height ) return ia.region.height > ib.region.height;
+        if( ia.region.width != ib.region.width ) return ia.region.width > ib.region.width;
+        return ia.name < ib.name;
+    });
+
+    /* Place images, pages may get added */
+    std::vector<int> xs(images.size()), ys(images.size());
+    size_t first_page = pages.size();
+    for( size_t i = 0; i < order.size(); ++i ) {
+        image_t& image = images[order[i]];
+        if( image.pixels.empty() ) continue;
+
+        int width = image.region.width + padding * 2;
+        int height = image.region.height + padding * 2;
+        if( width > page_width || height > page_height )
+            throw std::runtime_error("Image doesn't fit into atlas page: " + image.name);
+
+        size_t p = first_page;
+        for( ; p < pages.size(); ++p )
+            if( place(pages[p], width, height, &xs[order[i]], &ys[order[i]]) ) break;
+
+        if( p == pages.size() ) {
+            page_t page;
+            skyline_t ground = { 0, 0, page_width };
+            page.skyline.push_back(ground);
+            page.used_height = 0;
+            page.texture = 0;
+            pages.push_back(page);
+            place(pages[p], width, height, &xs[order[i]], &ys[order[i]]);
+        }
+        image.region.page = p;
+    }
+
+    /* Pages are as tall as needed, in powers of two */
+    for( size_t p = first_page; p < pages.size(); ++p ) {
+        page_t& page = pages[p];
+        int height = 1;
+        while( height < page.used_height ) height *= 2;
+        height = std::min(height, page_height);
+        page.pixels.assign(page_width * height * 4, 0);
+
+        for( size_t i = 0; i < images.size(); ++i ) {
+            image_t& image = images[i];
+            if( image.pixels.empty() || image.region.page != (int) p ) continue;
+
+            copy(page, image, xs[i], ys[i]);
+            image.region.s0 = (GLfloat) (xs[i] + padding) / page_width;
+            image.region.t0 = (GLfloat) (ys[i] + padding) / height;
+            image.region.s1 = (GLfloat) (xs[i] + padding + image.region.width) / page_width;
+            image.region.t1 = (GLfloat) (ys[i] + padding + image.region.height) / height;
+        }
+
+        size_t page_bytes = 0;
+        page.texture = create_texture(page.pixels.data(), page_width, height, GL_RGBA, options, &page_bytes);
+        bytes += page_bytes;
+        std::vector<char>().swap(page.pixels);
+
+        for( size_t i = 0; i < images.size(); ++i ) {
+            if( images[i].pixels.empty() || images[i].region.page != (int) p ) continue;
+            images[i].region.texture = page.texture;
+        }
+    }
+
+    /* Images are in GL now */
+    for( size_t i = 0; i < images.size(); ++i ) std::vector<char>().swap(images[i].pixels);
+}
+
+const Atlas::region_t* Atlas::get(int index) {
+    if( index < 0 || index >= (int) images.size() || images[index].region.texture == 0 ) return NULL;
+    return &images[index].region;
+}
+
+const Atlas::region_t* Atlas::find(const std::string& name) {
+    for( size_t i = 0; i < images.size(); ++i )
+        if( images[i].name == name ) return get(i);
+    return NULL;
+}
+
+void Atlas::addQuad(const region_t& region, GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1,
+                    std::vector<GLfloat>& vertices, std::vector<GLushort>& indexes) {
+    /* Indexes of one more quad must still fit 16 bits */
+    size_t quads = vertices.size() / 16;
+    if( quads >= MAX_QUADS ) throw std::runtime_error("Batch of quads is full");
+
+    GLushort first = quads * 4;
+    const GLfloat quad[] = {
+        x0, y0, region.s0, region.t0,
+        x1, y0, region.s1, region.t0,
+        x1, y1, region.s1, region.t1,
+        x0, y1, region.s0, region.t1,
+    };
+    vertices.insert(vertices.end(), quad, quad + 16);
+
+    const GLushort triangles[] = { 0, 1, 2, 0, 2, 3 };
+    for( int i = 0; i < 6; ++i ) indexes.push_back(first + triangles[i]);
+}
@@ -0,0 +1,99 @@
+#ifndef __ATLAS_H__
+#define __ATLAS_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "pngloader.h"
+
+/* Many small images packed into a few large textures (pages), so that a widget drawing them binds one
+   texture and may draw all of them with one call. Images are packed with the skyline bottom-left
+   algorithm, tallest first. Each image is surrounded by 'padding' pixels repeating its edges, so linear
+   filtering doesn't pick up neighbours. Mipmaps stay clean for about log2(padding) levels.
+
+   Add images in load() (any thread), call upload() in prepare() and look regions up afterwards */
+class Atlas {
+public:
+    /* Image in a page */
+    typedef struct {
+        GLuint texture;
+        int page;
+        /* Texture coordinates of the image corners: s0, t0 is its first pixel of the first row */
+        GLfloat s0, t0, s1, t1;
+        /* Image size in pixels */
+        size_t width;
+        size_t height;
+    } region_t;
+
+private:
+    typedef struct {
+        std::string name;
+        std::vector<char> pixels;
+        region_t region;
+    } image_t;
+
+    /* Top edge of used space from x to x + width */
+    typedef struct {
+        int x;
+        int y;
+        int width;
+    } skyline_t;
+
+    typedef struct {
+        std::vector<skyline_t> skyline;
+        std::vector<char> pixels;
+        int used_height;
+        GLuint texture;
+    } page_t;
+
+    int page_width;
+    int page_height;
+    int padding;
+
+    std::vector<image_t> images;
+    std::vector<page_t> pages;
+    std::mutex lock;
+    size_t bytes;
+
+    bool fit(const page_t& page, size_t node, int width, int height, int* y);
+    bool place(page_t& page, int width, int height, int* x, int* y);
+    void copy(page_t& page, const image_t& image, int x, int y);
+
+public:
+    /* Page size in pixels and padding around images. Pages aren't deleted, they live as long as
+       the GL context */
+    Atlas(int width, int height, int padding);
+
+    /* Decode PNG-file and add it. Returns image index. May be called from any thread */
+    int add(const char* path);
+    /* Add RGBA pixels under given name. Returns image index. May be called from any thread */
+    int add(const std::string& name, const char* pixels, size_t width, size_t height);
+
+    /* Pack images into pages and upload them. Throws if an image doesn't fit into a page.
+       Decoded pixels are freed afterwards */
+    void upload(const texture_options_t& options);
+
+    /* Image region by index or by name (path for PNG-files), NULL if there's no such image */
+    const region_t* get(int index);
+    const region_t* find(const std::string& name);
+
+    size_t getPageCount() { return pages.size(); }
+    /* GPU memory of all pages */
+    size_t getBytes() { return bytes; }
+
+    /* Quads a batch with 16-bit indexes holds */
+    static const size_t MAX_QUADS = 65536 / 4;
+
+    /* Append a quad showing the region at x0, y0 - x1, y1 to a batch of triangles: 4 vertices of
+       x, y, s, t floats and 6 indexes. The first vertex is at x0, y0 and shows the image's first pixel.
+       Throws if the batch already has MAX_QUADS quads: draw it and start a new one */
+    static void addQuad(const region_t& region, GLfloat x0, GLfloat y0, GLfloat x1, GLfloat y1,
+                        std::vector<GLfloat>& vertices, std::vector<GLushort>& indexes);
+};
+
+#endif
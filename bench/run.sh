@@ -0,0 +1,118 @@
+#!/bin/sh
+# Frame-throughput benchmark. Runs every example widget offscreen, uncapped, for a fixed number
+# of frames and compares per-phase timings (microseconds) with the stored baseline.
+#
+# Usage: sh bench/run.sh [--baseline]
+#   --baseline    store results as the new baseline instead of comparing
+#
+# Environment:
+#   BENCH_FRAMES          frames per widget (300)
+#   BENCH_TOLERANCE       allowed slowdown of median, percent (25)
+#   BENCH_P99_TOLERANCE   allowed slowdown of p99, percent (200)
+#   BENCH_SLACK           slowdown always allowed, microseconds (20)
+#   BENCH_ONCE_SLACK      slowdown always allowed in phases with less than 10 samples, microseconds (2000)
+#   BENCH_FONT            font for the clock widget, which is skipped when the font is missing
+#
+# Phases with less than 10 samples (e.g. one-time texture uploads) have no meaningful p99, only their
+# median is compared, with BENCH_ONCE_SLACK for the run to run noise of a single sample.
+
+FRAMES=${BENCH_FRAMES:-300}
+TOLERANCE=${BENCH_TOLERANCE:-25}
+P99_TOLERANCE=${BENCH_P99_TOLERANCE:-200}
+SLACK=${BENCH_SLACK:-20}
+ONCE_SLACK=${BENCH_ONCE_SLACK:-2000}
+FONT=${BENCH_FONT:-/usr/share/fonts/truetype/freefont/FreeSansBold.ttf}
+
+RESULTS=bench/results
+BASELINE=bench/baseline
+
+mkdir -p $RESULTS
+
+# Widgets which were run
+WIDGETS=
+
+# Run one widget: name and its command line parameters
+run() {
+    name=$1
+    shift
+
+    rm -f $RESULTS/$name.json
+    EGLWIDGET_BACKEND=headless EGLWIDGET_PACING=uncapped EGLWIDGET_FRAMES=$FRAMES \
+    EGLWIDGET_BENCH=$RESULTS/$name.json ./$name "$@" > $RESULTS/$name.log 2>&1
+
+    if [ ! -f $RESULTS/$name.json ]; then
+        echo "$name: benchmark failed, see $RESULTS/$name.log"
+        exit 1
+    fi
+    WIDGETS="$WIDGETS $name"
+}
+
+# Compare widget results with its baseline. Returns 1 on regression
+compare() {
+    name=$1
+
+    if [ ! -f $BASELINE/$name.json ]; then
+        echo "$name: no baseline, skipped"
+        return 0
+    fi
+
+    awk -v name=$name -v tolerance=$TOLERANCE -v p99_tolerance=$P99_TOLERANCE -v slack=$SLACK -v once_slack=$ONCE_SLACK '
+        # Phase line: "draw": { "count": 300, "min": 1.0, "median": 2.0, "p99": 3.0 },
+        { gsub(/[",{}:]/, " ") }
+
+        # GL state calls: "gl_calls_per_frame": { "issued": 2.0, "elided": 1.0 },
+        FNR != NR && $1 == "gl_calls_per_frame" {
+            printf "%-10s gl calls per frame: %.1f issued, %.1f elided\n", name, $3, $5
+            next
+        }
+
+        $2 != "count" { next }
+
+        FNR == NR { base_median[$1] = $7; base_p99[$1] = $9; next }
+
+        $3 > 0 && ($1 in base_median) {
+            status = "ok"
+            if( $3 < 10 ) {
+                if( $7 > base_median[$1] * (1 + tolerance / 100) + once_slack ) status = "REGRESSION (median)"
+            }
+            else {
+                if( $9 > base_p99[$1] * (1 + p99_tolerance / 100) + slack ) status = "REGRESSION (p99)"
+                if( $7 > base_median[$1] * (1 + tolerance / 100) + slack ) status = "REGRESSION (median)"
+            }
+            if( status != "ok" ) failed = 1
+
+            printf "%-10s %-8s median %9.1f -> %9.1f   p99 %9.1f -> %9.1f   %s\n",
+                   name, $1, base_median[$1], $7, base_p99[$1], $9, status
+        }
+
+        END { exit failed }
+    ' $BASELINE/$name.json $RESULTS/$name.json
+}
+
+run triangle
+run logo
+run texture
+if [ -f "$FONT" ]; then
+    run clock "$FONT"
+else
+    echo "clock: font $FONT not found, skipped (set BENCH_FONT)"
+fi
+
+if [ "$1" = "--baseline" ]; then
+    mkdir -p $BASELINE
+    for name in $WIDGETS; do
+        cp $RESULTS/$name.json $BASELINE/
+    done
+    echo "Baseline saved to $BASELINE"
+    exit 0
+fi
+
+failed=0
+for name in $WIDGETS; do
+    compare $name || failed=1
+done
+
+if [ $failed -ne 0 ]; then
+    echo "Benchmark regressions found (tolerance: median $TOLERANCE%, p99 $P99_TOLERANCE%, slack ${SLACK}us, ${ONCE_SLACK}us once)"
+    exit 1
+fi
@@ -0,0 +1,59 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+
+#include "cachefile.h"
+
+/* Choose cache directory */
+std::string cache_directory(const char* env) {
+    const char* dir = getenv(env);
+    if( dir != NULL ) return dir;
+    if( getenv("XDG_CACHE_HOME") != NULL ) return std::string(getenv("XDG_CACHE_HOME")) + "/eglwidgets";
+    if( getenv("HOME") != NULL ) return std::string(getenv("HOME")) + "/.cache/eglwidgets";
+    return "";
+}
+
+/* Create directory with all its parents */
+bool make_dirs(const std::string& dir) {
+    for( size_t i = 1; i <= dir.size(); ++i ) {
+        if( i < dir.size() && dir[i] != '/' ) continue;
+        if( mkdir(dir.substr(0, i).c_str(), 0755) < 0 && errno != EEXIST ) return false;
+    }
+    return true;
+}
+
+/* 64-bit FNV-1a hash */
+uint64_t fnv1a(uint64_t hash, const char* data, size_t len) {
+    for( size_t i = 0; i < len; ++i ) {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/* Write file through a temporary one */
+bool write_cache_file(const std::string& dir, const std::string& path, const std::vector<char>& data) {
+    if( ! make_dirs(dir) ) {
+        printf("Cannot create cache directory %s\n", dir.c_str());
+        return false;
+    }
+
+    /* Threads of one process may write the same file too */
+    static std::atomic<unsigned> writes(0);
+    char tmp[32];
+    snprintf(tmp, sizeof(tmp), ".%d.%u", getpid(), writes++);
+    std::string tmp_path = path + tmp;
+
+    FILE* fp = fopen(tmp_path.c_str(), "wb");
+    if( fp == NULL ) return false;
+
+    bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+    ok = (fclose(fp) == 0) && ok;
+
+    if( ok && rename(tmp_path.c_str(), path.c_str()) == 0 ) return true;
+    unlink(tmp_path.c_str());
+    return false;
+}
@@ -0,0 +1,26 @@
+#ifndef __CACHEFILE_H__
+#define __CACHEFILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Helpers of on-disk caches (shader binaries, parsed meshes) */
+
+/* Cache directory: $<env>, $XDG_CACHE_HOME/eglwidgets or ~/.cache/eglwidgets. Empty, meaning
+   the cache is disabled, if <env> is set to an empty string */
+std::string cache_directory(const char* env);
+
+/* Create directory with all its parents */
+bool make_dirs(const std::string& dir);
+
+/* 64-bit FNV-1a hash, start with FNV1A_SEED */
+static const uint64_t FNV1A_SEED = 0xcbf29ce484222325ULL;
+uint64_t fnv1a(uint64_t hash, const char* data, size_t len);
+
+/* Write file to a temporary one and rename it, so that other processes never see half-written files.
+   The directory is created if needed */
+bool write_cache_file(const std::string& dir, const std::string& path, const std::vector<char>& data);
+
+#endif
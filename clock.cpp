@@ -1,6 +1,8 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <stdexcept>
 #include <string>
 
@@ -13,6 +15,9 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "clock.h"
+#include "pixels.h"
+#include "shaders/clock_vertex.h"
+#include "shaders/clock_fragment.h"
 
 using namespace glm;
 
@@ -25,6 +30,15 @@ const char* Clock::fragmentShader() {
     return "shaders/clock_fragment.shader";
 }
 
+/* Shader sources embedded at build time */
+const char* Clock::vertexShaderSource() {
+    return clock_vertex_shader;
+}
+
+const char* Clock::fragmentShaderSource() {
+    return clock_fragment_shader;
+}
+
 /* Plane made of two triangles */
 /*
   B +----------+ A          x: +1           t: 1
@@ -55,38 +69,20 @@ void Clock::prepare() {
     /* Calling parent */
     EGLWidget::prepare();
 
-    /* We want transparency */
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     /* Create buffer and load vertex data */
-    GLuint vert_buf;
     glGenBuffers(1, &vert_buf);
     glBindBuffer(GL_ARRAY_BUFFER, vert_buf);
     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
 
-    /* Create 'vertex_xyz' shader parameter which represent vertex coodrinates */
+    /* Get 'vertex_xyz' and 'vertex_st' shader parameters which represent vertex and texture coodrinates */
     v_xyz = glGetAttribLocation(program, "vertex_xyz");
-    glEnableVertexAttribArray(v_xyz);
-    /* Vertex structure: 3 float-s per coordinate, total 5 floats, coordinate data starts at index 0 */
-    glVertexAttribPointer(v_xyz, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
-
-    /* Prepare shader parameter 'vertex"st' which represent texture coordinates */
     v_st  = glGetAttribLocation(program, "vertex_st");
-    glEnableVertexAttribArray(v_st);
-    /* Texture structure: 2 floats per texture coordinate, total 5 floats, texture data starts at index 3 */
-    glVertexAttribPointer(v_st, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
 
     /* Load our triangle into the buffer */
-    GLuint index_buf;
     glGenBuffers(1, &index_buf);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indexes), indexes, GL_STATIC_DRAW);
 
-    /* Zero-ing the texture and enable it */
-    memset( clock_texture, 0, sizeof(clock_texture) );
-    glEnable (GL_TEXTURE_2D);
-
     /* Create a texture buffer */
     glGenTextures(1, &texture_id);
     assert(texture_id != 0);
@@ -98,30 +94,66 @@ void Clock::prepare() {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    /* The texture is magnified and rewritten every second, mipmaps aren't worth it */
     glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
 
-    /* Loading texture data: 256x256 pixels, RGBA format */
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, clock_texture);
+    /* Loading texture data: 256x256 pixels, RGBA format. Nothing has been published yet, so it's blank */
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, state.front().texture);
 
     /* Get 'u_texture' shader parameter descriptor */
     u_texture = glGetUniformLocation(program, "u_texture");
     printf("Texture id: %d, u_texture: %d\n", texture_id, u_texture);
 }
 
-/* Draw text given font size and pen coordinates */
-void Clock::printText(const char* text, int pen_x, int pen_y, int size) {
+/* Bind our buffers and texture */
+void Clock::bind() {
+    /* Calling parent */
+    EGLWidget::bind();
+
+    /* We want transparency. Texture colours are premultiplied by alpha */
+    gl->enable(GL_BLEND);
+    gl->blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, vert_buf);
+
+    /* Vertex structure: 3 float-s per coordinate, total 5 floats, coordinate data starts at index 0 */
+    gl->enableVertexAttribArray(v_xyz);
+    glVertexAttribPointer(v_xyz, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
+
+    /* Texture structure: 2 floats per texture coordinate, total 5 floats, texture data starts at index 3 */
+    gl->enableVertexAttribArray(v_st);
+    glVertexAttribPointer(v_st, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+
+    gl->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+    gl->activeTexture(GL_TEXTURE0);
+    gl->bindTexture(GL_TEXTURE_2D, texture_id);
+}
+
+/* Draw text given font size and pen coordinates. Returns texture area which differs from
+   the previously printed text: from the first changed character to the end of the line */
+Damage::rect_t Clock::printText(const char* text, const char* previous, int pen_x, int pen_y, int size) {
     /* Make sure the font supports our size */
     assert( FT_Set_Pixel_Sizes(face, 0, size) == 0 );
 
     /* All work is done using so called "glyph slot" */
     FT_GlyphSlot g = face->glyph;
 
+    /* Line band with some room for descenders */
+    Damage::rect_t changed = { 0, std::max(pen_y - size, 0), 0, 0 };
+    changed.height = std::min(pen_y + size / 2, 256) - changed.y;
+    bool same = true;
+
     /* Draw text one symbol at a time */
     for( int i = 0; text[i] != 0; ++i ) {
         /* Load glyph data */
         assert( FT_Load_Char(face, text[i], FT_LOAD_RENDER) == 0 );
 
+        /* Old glyphs might stick out of the new ones, so the rest of the line is changed */
+        if( same && text[i] != previous[i] ) {
+            same = false;
+            changed.x = std::min(std::max(std::min(pen_x + (int) g->bitmap_left, pen_x), 0), 255);
+        }
+
         /* Glyph size */
         int gw = g->bitmap.width;
         int gh = g->bitmap.rows;
@@ -130,65 +162,135 @@ void Clock::printText(const char* text, int pen_x, int pen_y, int size) {
         int texture_x = pen_x + g->bitmap_left;
         int texture_y = pen_y - g->bitmap_top;
 
-        /* Copy glyph bitmap */
+        /* Glyphs sticking out of the texture wrap to the next rows */
+        if( ! same ) {
+            if( texture_x + gw > 256 ) changed.x = 0;
+            changed.width = 256 - changed.x;
+        }
+
+        /* Copy glyph bitmap row by row. Pixels are encoded as 0..255 grey scale, which becomes alpha
+           of #FF6600 colour, premultiplied */
+        static const unsigned char color[4] = { 255, 102, 0, 255 };
         for( int row = 0; row < gh; ++row ) {
-            for( int col = 0; col < gw; ++col ) {
-                /* Get on pixel from the glyph. Pixel is encoded as 0..255 grey scale*/
-                unsigned char color = g->bitmap.buffer[ col + row * gw ];
-
-                /* Where do we have to copy our pixel */
-                pixel_t& pixel = clock_texture[ texture_x + col + (texture_y + row) * 256 ];
-                /* Pixel color: #FF6600 */
-                pixel.r = 255;
-                pixel.g = 102;
-                pixel.b = 0;
-                /* Set alpha value equal to glyph pixel value */
-                pixel.a = color;
-            }
+            pixel_t* pixels = &state.back().texture[ texture_x + (texture_y + row) * 256 ];
+            colorize_coverage(&g->bitmap.buffer[ row * gw ], (unsigned char*) pixels, gw, color);
         }
 
         /* Move pen position using glyph's special 'advance' value, divided by 64 */
         pen_x += g->advance.x >> 6;
     }
+
+    /* Previous text was longer */
+    if( same && strlen(previous) > strlen(text) ) {
+        changed.x = std::min(std::max(pen_x, 0), 255);
+        changed.width = 256 - changed.x;
+    }
+
+    return changed;
 }
 
+/* Clock plane transformation */
+static mat4 transform(GLfloat angle) {
+    /* Calculate rotation and scaling matices */
+    mat4 model;
+    mat4 rotated = rotate(model, angle, vec3(0, 0, 1.0));
+    mat4 scaled = scale(rotated, vec3(1, 1, 1));
+    return rotated * scaled;
+}
 
-/* Draw one frame */
-void Clock::draw() {
-    /* Call parent method*/
-    EGLWidget::draw();
+/* Request a redraw of widget area covered by given texture area */
+void Clock::damageTexture(const Damage::rect_t& area) {
+    if( Damage::isEmpty(area) ) return;
+
+    mat4 mvp = transform(angle);
+
+    float x0 = width, y0 = height, x1 = 0, y1 = 0;
+    for( int i = 0; i < 4; ++i ) {
+        int tx = area.x + ((i & 1) ? area.width : 0);
+        int ty = area.y + ((i & 2) ? area.height : 0);
+
+        /* Texture rows go from the top of the plane as the fragment shader flips them */
+        vec4 clip = mvp * vec4(tx / 128.0f - 1, 1 - ty / 128.0f, 0, 1);
+
+        float wx = (clip.x + 1) / 2 * width;
+        float wy = (1 - clip.y) / 2 * height;
+        x0 = std::min(x0, wx);
+        y0 = std::min(y0, wy);
+        x1 = std::max(x1, wx);
+        y1 = std::max(y1, wy);
+    }
 
-    /* Redraw clock texture only when time actually changed */
-    time_t now = time(NULL);
+    /* Linear filtering reaches one pixel further */
+    int dx = (int) floorf(x0) - 1;
+    int dy = (int) floorf(y0) - 1;
+    damage(dx, dy, (int) ceilf(x1) + 1 - dx, (int) ceilf(y1) + 1 - dy);
+}
+
+
+/* Redraw clock texture only when time actually changed */
+void Clock::update() {
+    /* Same clock as nextWakeup() uses, time() may lag behind it */
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    time_t now = ts.tv_sec;
 
     if( now != last_time ) {
-        char text[64];
+        char text[2][64];
         struct tm * timeinfo = localtime(&now);
-        strftime(text, sizeof(text), "%H:%M:%S", timeinfo);
+        strftime(text[0], sizeof(text[0]), "%H:%M:%S", timeinfo);
+        strftime(text[1], sizeof(text[1]), "%d %b", timeinfo);
 
         /* Hour:min:sec*/
-        memset(clock_texture, 0, sizeof(clock_texture));
-        printText(text, 50, 60, font_size);
+        memset(state.back().texture, 0, sizeof(state.back().texture));
+        Damage::rect_t time_area = printText(text[0], last_text[0], 50, 60, font_size);
 
         /* Date month */
-        strftime(text, sizeof(text), "%d %b", timeinfo);
-        printText(text, 140, 90, 30);
+        Damage::rect_t date_area = printText(text[1], last_text[1], 140, 90, 30);
 
-        /* Update clock texture with the new data */
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, clock_texture);
+        /* Hand the texture over to draw() and ask for a redraw of the changed characters */
+        state.publish();
+        if( last_time == 0 ) {
+            invalidate();
+        }
+        else {
+            damageTexture(time_area);
+            damageTexture(date_area);
+        }
+
+        memcpy(last_text, text, sizeof(last_text));
     }
 
     last_time = now;
+}
 
-    /* Calculate rotation and scaling matices */
-    mat4 model;
-    mat4 rotated = rotate(model, angle, vec3(0, 0, 1.0));
-    mat4 scaled = scale(rotated, vec3(1, 1, 1));
-    mat4 mvp = rotated * scaled;
+/* Wake up exactly when the next second starts */
+uint64_t Clock::nextWakeup(uint64_t now) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    /* Shown time is already outdated */
+    if( ts.tv_sec != last_time ) return now;
+
+    return now + (1000000000ULL - ts.tv_nsec);
+}
+
+/* Draw one frame */
+void Clock::draw() {
+    /* Call parent method*/
+    EGLWidget::draw();
+
+    /* Update clock texture with the new data */
+    if( state.fetch() ) {
+        uint64_t start = FramePacer::now();
+        gl->bindTexture(GL_TEXTURE_2D, texture_id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 256, 256, 0, GL_RGBA, GL_UNSIGNED_BYTE, state.front().texture);
+        recordPhase(FrameStats::PHASE_UPLOAD, start);
+    }
+
+    mat4 mvp = transform(angle);
 
     /* Pass updated MVP matrix to the shader */
-    glUniformMatrix4fv(u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+    gl->uniformMatrix4fv(u_mvp, glm::value_ptr(mvp));
 
     /* Draw clock plane/texture */
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
@@ -196,10 +298,10 @@ void Clock::draw() {
 
 /* Clock widget */
 Clock::Clock(const char* font, int size): EGLWidget(0, 0, 400, 400) {
-    /* Initialize FreeType library */
-    assert( FT_Init_FreeType(&library) == 0 );
-    assert( FT_New_Face(library, font, 0, &face) == 0 );
-
+    /* FreeType library is initialized by load() */
+    library = NULL;
+    face = NULL;
+    font_file = font;
     font_size = size;
 
     /* Clock rotation. To rotate the clock face to 90 degrees use M_PI / 4.0 */
@@ -210,16 +312,26 @@ Clock::Clock(const char* font, int size): EGLWidget(0, 0, 400, 400) {
     v_st = 0;
     texture_id = 0;
     u_texture = 0;
+    vert_buf = 0;
+    index_buf = 0;
 
     /* Last update time */
     last_time = 0;
+    memset(last_text, 0, sizeof(last_text));
+}
+
+/* Initialize FreeType library and load font face on a worker thread */
+void Clock::load() {
+    if( FT_Init_FreeType(&library) != 0 ) throw std::runtime_error("Cannot initialize FreeType");
+    if( FT_New_Face(library, font_file, 0, &face) != 0 ) throw std::runtime_error(std::string("Cannot load font: ") + font_file);
 }
 
 /* Free up resources */
 Clock::~Clock() {
-    FT_Done_FreeType(library);
+    if( library != NULL ) FT_Done_FreeType(library);
 }
 
+#ifndef EGLWIDGET_NO_MAIN
 int main(int argc, char** argv) {
 #ifdef IS_RPI
     bcm_host_init();
@@ -233,3 +345,4 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Error: %s", ex.what());
     }
 }
+#endif
@@ -2,6 +2,7 @@
 #define __CLOCK_H__
 
 #include "widget.h"
+#include "triplebuffer.h"
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -15,13 +16,19 @@ private:
     /* FreeType library resources */
     FT_Library library;
     FT_Face face;
+    /* Font file */
+    const char* font_file;
 
     typedef struct {
         unsigned char r, g, b, a;
     } pixel_t;
 
-    /* Clock texture, 256x256 size */
-    pixel_t clock_texture[ 256 * 256 ];
+    /* State passed from update() to draw(), which may run on different threads */
+    typedef struct {
+        /* Clock texture, 256x256 size */
+        pixel_t texture[ 256 * 256 ];
+    } state_t;
+    TripleBuffer<state_t> state;
 
     /* Widget rotation angle */
     GLfloat angle;
@@ -32,20 +39,34 @@ private:
     GLuint texture_id;
     GLuint u_texture;
 
+    /* Vertex and index buffers */
+    GLuint vert_buf;
+    GLuint index_buf;
+
     /* Last update time, font size */
     time_t last_time;
     int font_size;
 
-    void printText(const char* text, int pen_x, int pen_y, int size);
+    /* Last printed time and date, only changed characters are redrawn */
+    char last_text[2][64];
+
+    Damage::rect_t printText(const char* text, const char* previous, int pen_x, int pen_y, int size);
+    void damageTexture(const Damage::rect_t& area);
 
 public:
     Clock(const char* font, int size);
     ~Clock();
+    virtual void load();
 
     virtual void prepare();
+    virtual void bind();
+    virtual void update();
+    virtual uint64_t nextWakeup(uint64_t now);
     virtual void draw();
     virtual const char* vertexShader();
     virtual const char* fragmentShader();
+    virtual const char* vertexShaderSource();
+    virtual const char* fragmentShaderSource();
 };
 
 #endif
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "compositor.h"
+
+/* Compositor owns the EGL surface all hosted widgets draw into */
+Compositor::Compositor(int sx, int sy, int sw, int sh): EGLWidget(sx, sy, sw, sh) {
+    max_attribs = 0;
+}
+
+/* Add hosted widget */
+void Compositor::add(EGLWidget* widget, int fps) {
+    if( widget->host != NULL ) throw std::runtime_error("Widget is already hosted");
+    if( widget->surface != EGL_NO_SURFACE ) throw std::runtime_error("Widget has its own surface");
+
+    widget->attach(this);
+
+    child_t child;
+    child.widget = widget;
+    child.fps = fps;
+    children.push_back(child);
+}
+
+/* Add hosted widget at given position */
+void Compositor::add(EGLWidget* widget, int fps, int x, int y) {
+    add(widget, fps);
+
+    widget->x = x;
+    widget->y = y;
+}
+
+/* Compositor itself has no shader program */
+const char* Compositor::vertexShader() {
+    return NULL;
+}
+
+const char* Compositor::fragmentShader() {
+    return NULL;
+}
+
+/* Shared framebuffer has to satisfy every hosted widget */
+EGLWidget::framebuffer_t Compositor::framebuffer() {
+    if( children.empty() ) return EGLWidget::framebuffer();
+
+    framebuffer_t fb = { 0, 0, 0, 0, 0, 0, 0 };
+    for( size_t i = 0; i < children.size(); ++i ) {
+        framebuffer_t child = children[i].widget->framebuffer();
+        fb.red = std::max(fb.red, child.red);
+        fb.green = std::max(fb.green, child.green);
+        fb.blue = std::max(fb.blue, child.blue);
+        fb.alpha = std::max(fb.alpha, child.alpha);
+        fb.depth = std::max(fb.depth, child.depth);
+        fb.stencil = std::max(fb.stencil, child.stencil);
+        fb.samples = std::max(fb.samples, child.samples);
+    }
+    return fb;
+}
+
+/* Reset GL state which hosted widgets may leave behind */
+void Compositor::resetState() {
+    gl->disable(GL_BLEND);
+    gl->disable(GL_SCISSOR_TEST);
+    gl->disable(GL_DEPTH_TEST);
+
+    for( GLint i = 0; i < max_attribs; ++i )
+        gl->disableVertexAttribArray(i);
+}
+
+/* Load files of all hosted widgets in parallel */
+void Compositor::startLoading(std::vector<std::future<void> >& tasks) {
+    EGLWidget::startLoading(tasks);
+
+    for( size_t i = 0; i < children.size(); ++i )
+        children[i].widget->startLoading(tasks);
+}
+
+/* Compile shaders of all hosted widgets while their files are being loaded */
+void Compositor::loadShaders() {
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attribs);
+
+    for( size_t i = 0; i < children.size(); ++i ) {
+        /* Our EGL surface exists now */
+        children[i].widget->attach(this);
+
+        resetState();
+        children[i].widget->loadShaders();
+    }
+}
+
+/* Prepare all hosted widgets */
+void Compositor::prepare() {
+    /* Call parent */
+    EGLWidget::prepare();
+
+    for( size_t i = 0; i < children.size(); ++i ) {
+        child_t& child = children[i];
+
+        resetState();
+        child.widget->prepare();
+
+        /* Cached widget gets a layer as big as its viewport */
+        if( child.widget->cached ) child.widget->createLayer();
+
+        /* Widget updates are paced at widget's own FPS, unless we're drawing as fast as possible */
+        child.pacer.start(pacing == FramePacer::PACE_UNCAPPED ? FramePacer::PACE_UNCAPPED : FramePacer::PACE_FIXED,
+                          child.fps);
+    }
+
+    printf("Compositor: %zu widgets\n", children.size());
+}
+
+/* Update widgets which are due. Widgets invalidate us through their invalidate() */
+void Compositor::update() {
+    uint64_t now = FramePacer::now();
+
+    for( size_t i = 0; i < children.size(); ++i ) {
+        child_t& child = children[i];
+        EGLWidget* widget = child.widget;
+
+        /* Same rules as in the main loop: redraw requests and wakeups are limited by widget's FPS */
+        uint64_t due = widget->dirty ? now : widget->nextWakeup(now);
+        if( due < child.pacer.getDeadline() ) due = child.pacer.getDeadline();
+        if( due > now ) continue;
+
+        child.pacer.resume(now);
+        widget->update();
+        child.pacer.frameDone();
+    }
+}
+
+/* Wake up when the first of our widgets is due */
+uint64_t Compositor::nextWakeup(uint64_t now) {
+    uint64_t next = UINT64_MAX;
+
+    for( size_t i = 0; i < children.size(); ++i ) {
+        child_t& child = children[i];
+        EGLWidget* widget = child.widget;
+
+        uint64_t due = widget->dirty ? now : widget->nextWakeup(now);
+        if( due < child.pacer.getDeadline() ) due = child.pacer.getDeadline();
+        if( due < next ) next = due;
+    }
+
+    return next;
+}
+
+/* Draw all hosted widgets into their viewports */
+void Compositor::draw() {
+    /* Clear the area being repainted */
+    gl->viewport(0, 0, scaled(width), scaled(height));
+    setScissor(repaint);
+    glClear(clear_mask);
+
+    /* Only widgets within the repainted area are drawn, the rest of the back buffer still
+       holds them. Widgets change their state in update() only, so drawing doesn't speed up their animation */
+    for( size_t i = 0; i < children.size(); ++i ) {
+        EGLWidget* widget = children[i].widget;
+
+        Damage::rect_t area = { (int) widget->x, (int) widget->y, (int) widget->width, (int) widget->height };
+        if( ! Damage::intersects(area, repaint) ) {
+            /* Its damage, if any, was outside the surface. Staying dirty would make update() and nextWakeup()
+               treat it as due on every period */
+            widget->dirty = false;
+            continue;
+        }
+
+        resetState();
+
+        if( widget->layer.isEnabled() ) {
+            /* Redraw the layer only when the widget has changed */
+            if( widget->dirty || ! widget->layer.isValid() ) {
+                widget->drawing_layer = true;
+                widget->layer.begin(gl);
+                widget->bind();
+                widget->draw();
+                widget->layer.end(offscreen.isEnabled() ? &offscreen : NULL);
+                widget->drawing_layer = false;
+
+                resetState();
+            }
+
+            /* Layer has been drawn onto transparent black, so its colors are premultiplied by alpha */
+            widget->setViewport();
+            gl->enable(GL_BLEND);
+            gl->blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            widget->layer.draw(gl, layer_program);
+        }
+        else {
+            widget->bind();
+            widget->draw();
+        }
+
+        if( widget->dirty ) {
+            widget->frames += 1;
+            widget->dirty = false;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef __COMPOSITOR_H__
+#define __COMPOSITOR_H__
+
+#include <vector>
+
+#include "widget.h"
+
+/* Widget which hosts many widgets on one EGL surface. All hosted widgets share one EGL context,
+   one main loop and one eglSwapBuffers() per frame, each widget drawing into its own viewport.
+
+   Usage:
+       Compositor compositor(0, 0, 1280, 720);
+       Clock clock(font, 50);
+       Logo logo(mesh, 1.0);
+
+       compositor.add(&clock, 2);
+       compositor.add(&logo, 30, 400, 0);
+       compositor.run(60);
+*/
+class Compositor: public EGLWidget {
+private:
+    /* Hosted widget */
+    typedef struct {
+        EGLWidget* widget;
+        /* Paces widget's updates at its own FPS */
+        FramePacer pacer;
+        int fps;
+    } child_t;
+
+    std::vector<child_t> children;
+
+    /* Number of vertex attributes to reset between widgets */
+    GLint max_attribs;
+
+    void resetState();
+
+    virtual void startLoading(std::vector<std::future<void> >& tasks);
+    virtual void loadShaders();
+
+protected:
+    virtual void prepare();
+    virtual void update();
+    virtual uint64_t nextWakeup(uint64_t now);
+    virtual void draw();
+    virtual const char* vertexShader();
+    virtual const char* fragmentShader();
+    virtual framebuffer_t framebuffer();
+
+public:
+    Compositor(int sx, int sy, int sw, int sh);
+
+    /* Add hosted widget updated at given FPS. Widget's coordinates become relative to our surface */
+    void add(EGLWidget* widget, int fps);
+    /* Add hosted widget and move it to given position on the compositor's surface */
+    void add(EGLWidget* widget, int fps, int x, int y);
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "damage.h"
+
+/* Older EGL headers may lack these */
+#ifndef EGL_BUFFER_AGE_EXT
+#define EGL_BUFFER_AGE_EXT 0x313D
+#endif
+
+/* Does EGL display support given extension */
+static bool has_extension(EGLDisplay display, const char* name) {
+    const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if( extensions == NULL ) return false;
+
+    size_t len = strlen(name);
+    for( const char* p = strstr(extensions, name); p != NULL; p = strstr(p + len, name) ) {
+        if( (p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0') ) return true;
+    }
+    return false;
+}
+
+Damage::Damage() {
+    width = 0;
+    height = 0;
+    enabled = false;
+    buffer_age = false;
+    swapWithDamage = NULL;
+    setDamageRegion = NULL;
+    pending_full = true;
+    frame_full = true;
+    history_size = 0;
+}
+
+/* Check EGL extensions */
+void Damage::init(EGLDisplay display, int surface_width, int surface_height) {
+    width = surface_width;
+    height = surface_height;
+
+    const char* env = getenv("EGLWIDGET_DAMAGE");
+    enabled = env == NULL || strcmp(env, "0") != 0;
+    if( ! enabled ) return;
+
+    buffer_age = has_extension(display, "EGL_EXT_buffer_age") || has_extension(display, "EGL_KHR_partial_update");
+
+    if( has_extension(display, "EGL_KHR_partial_update") )
+        setDamageRegion = (set_damage_region_t) eglGetProcAddress("eglSetDamageRegionKHR");
+
+    if( has_extension(display, "EGL_KHR_swap_buffers_with_damage") )
+        swapWithDamage = (swap_with_damage_t) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    else if( has_extension(display, "EGL_EXT_swap_buffers_with_damage") )
+        swapWithDamage = (swap_with_damage_t) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+
+    printf("Damage tracking: buffer age %s, partial update %s, swap with damage %s\n",
+           buffer_age ? "yes" : "no", setDamageRegion ? "yes" : "no", swapWithDamage ? "yes" : "no");
+}
+
+/* Clip rectangle to the surface */
+Damage::rect_t Damage::clip(const rect_t& r) {
+    int x0 = std::max(r.x, 0);
+    int y0 = std::max(r.y, 0);
+    int x1 = std::min(r.x + r.width, width);
+    int y1 = std::min(r.y + r.height, height);
+
+    rect_t result = { x0, y0, x1 - x0, y1 - y0 };
+    return result;
+}
+
+/* Bounding box of two rectangles */
+Damage::rect_t Damage::unite(const rect_t& a, const rect_t& b) {
+    if( isEmpty(a) ) return b;
+    if( isEmpty(b) ) return a;
+
+    int x0 = std::min(a.x, b.x);
+    int y0 = std::min(a.y, b.y);
+    int x1 = std::max(a.x + a.width, b.x + b.width);
+    int y1 = std::max(a.y + a.height, b.y + b.height);
+
+    rect_t result = { x0, y0, x1 - x0, y1 - y0 };
+    return result;
+}
+
+/* Common part of two rectangles, may be empty */
+Damage::rect_t Damage::intersect(const rect_t& a, const rect_t& b) {
+    int x0 = std::max(a.x, b.x);
+    int y0 = std::max(a.y, b.y);
+    int x1 = std::min(a.x + a.width, b.x + b.width);
+    int y1 = std::min(a.y + a.height, b.y + b.height);
+
+    rect_t result = { x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0) };
+    return result;
+}
+
+bool Damage::intersects(const rect_t& a, const rect_t& b) {
+    return a.x < b.x + b.width && b.x < a.x + a.width &&
+           a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+/* Report changed area */
+void Damage::add(const rect_t& r) {
+    std::lock_guard<std::mutex> guard(lock);
+    if( pending_full ) return;
+
+    rect_t clipped = clip(r);
+    if( isEmpty(clipped) ) return;
+
+    /* Too many rectangles: keep their bounding box */
+    if( (int) pending.size() >= MAX_RECTS ) {
+        rect_t box = clipped;
+        for( size_t i = 0; i < pending.size(); ++i ) box = unite(box, pending[i]);
+        pending.clear();
+        pending.push_back(box);
+        return;
+    }
+
+    pending.push_back(clipped);
+}
+
+/* Report that everything has changed */
+void Damage::addFull() {
+    std::lock_guard<std::mutex> guard(lock);
+    pending_full = true;
+    pending.clear();
+}
+
+/* Remember damage of a frame for buffer age */
+void Damage::remember(const rect_t& box) {
+    for( int i = MAX_AGE - 1; i > 0; --i ) history[i] = history[i - 1];
+    history[0] = box;
+    if( history_size < MAX_AGE ) history_size += 1;
+}
+
+/* Take reported damage and find out what has to be repainted */
+Damage::rect_t Damage::begin(EGLDisplay display, EGLSurface surface) {
+    rect_t all = { 0, 0, width, height };
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        frame_full = pending_full || pending.empty();
+        frame.swap(pending);
+        pending.clear();
+        pending_full = false;
+    }
+
+    /* Bounding box of this frame's damage */
+    rect_t box = { 0, 0, 0, 0 };
+    if( frame_full ) box = all;
+    for( size_t i = 0; i < frame.size(); ++i ) box = unite(box, frame[i]);
+    remember(box);
+
+    if( ! enabled || ! buffer_age || frame_full ) return all;
+
+    /* Back buffer has been drawn 'age' frames ago, so it misses damage of the frames since then.
+       Age 0 means unknown content */
+    EGLint age = 0;
+    if( ! eglQuerySurface(display, surface, EGL_BUFFER_AGE_EXT, &age) ) age = 0;
+    if( age <= 0 || age > history_size ) return all;
+
+    rect_t repaint = box;
+    for( int i = 1; i < age; ++i ) repaint = unite(repaint, history[i]);
+
+    /* Tell the driver it may keep the rest of the buffer */
+    if( setDamageRegion != NULL ) {
+        EGLint rect[4] = { repaint.x, height - repaint.y - repaint.height, repaint.width, repaint.height };
+        setDamageRegion(display, surface, rect, 1);
+    }
+
+    return repaint;
+}
+
+/* Swap buffers passing this frame's damage in GL coordinates (origin at the bottom left corner) */
+void Damage::swap(EGLDisplay display, EGLSurface surface) {
+    if( ! enabled || swapWithDamage == NULL || frame_full || frame.empty() ) {
+        eglSwapBuffers(display, surface);
+        return;
+    }
+
+    std::vector<EGLint> rects(frame.size() * 4);
+    for( size_t i = 0; i < frame.size(); ++i ) {
+        rects[i * 4 + 0] = frame[i].x;
+        rects[i * 4 + 1] = height - frame[i].y - frame[i].height;
+        rects[i * 4 + 2] = frame[i].width;
+        rects[i * 4 + 3] = frame[i].height;
+    }
+
+    swapWithDamage(display, surface, &rects[0], frame.size());
+}
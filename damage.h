@@ -0,0 +1,86 @@
+#ifndef __DAMAGE_H__
+#define __DAMAGE_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <mutex>
+#include <vector>
+
+/* Damage tracking for partial redraws.
+
+   Widgets report changed rectangles, the main loop repaints only what has changed since the
+   back buffer was last drawn (EGL_EXT_buffer_age / EGL_KHR_partial_update) and tells the
+   display server which part of the surface changed (EGL_KHR_swap_buffers_with_damage).
+   Without buffer age every frame is repainted completely.
+
+   Set EGLWIDGET_DAMAGE=0 to always repaint whole frames */
+class Damage {
+public:
+    /* Rectangle in pixels, origin at the top left corner of the surface */
+    typedef struct {
+        int x;
+        int y;
+        int width;
+        int height;
+    } rect_t;
+
+private:
+    typedef EGLBoolean (*swap_with_damage_t)(EGLDisplay, EGLSurface, const EGLint*, EGLint);
+    typedef EGLBoolean (*set_damage_region_t)(EGLDisplay, EGLSurface, EGLint*, EGLint);
+
+    /* Pending rectangles are merged into one when there are more of them */
+    static const int MAX_RECTS = 8;
+    /* Number of frames remembered for buffer age */
+    static const int MAX_AGE = 4;
+
+    /* Surface size */
+    int width;
+    int height;
+
+    /* Supported extensions */
+    bool enabled;
+    bool buffer_age;
+    swap_with_damage_t swapWithDamage;
+    set_damage_region_t setDamageRegion;
+
+    /* Damage reported since the last frame. add() may be called from any thread */
+    std::mutex lock;
+    bool pending_full;
+    std::vector<rect_t> pending;
+
+    /* Damage of the frame being drawn */
+    bool frame_full;
+    std::vector<rect_t> frame;
+
+    /* Bounding boxes of damage of previous frames, [0] is the latest */
+    rect_t history[MAX_AGE];
+    int history_size;
+
+    rect_t clip(const rect_t& r);
+    void remember(const rect_t& box);
+
+public:
+    Damage();
+
+    /* Check EGL extensions, called once the surface exists */
+    void init(EGLDisplay display, int surface_width, int surface_height);
+
+    /* Report changed area */
+    void add(const rect_t& r);
+    /* Report that everything has changed */
+    void addFull();
+
+    /* Start drawing a frame: take reported damage and return the area which has to be repainted */
+    rect_t begin(EGLDisplay display, EGLSurface surface);
+    /* Finish the frame */
+    void swap(EGLDisplay display, EGLSurface surface);
+
+    /* Helpers */
+    static rect_t unite(const rect_t& a, const rect_t& b);
+    static rect_t intersect(const rect_t& a, const rect_t& b);
+    static bool intersects(const rect_t& a, const rect_t& b);
+    static bool isEmpty(const rect_t& r) { return r.width <= 0 || r.height <= 0; }
+};
+
+#endif
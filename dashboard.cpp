@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "compositor.h"
+#include "clock.h"
+#include "texture.h"
+#include "logo.h"
+#include "triangle.h"
+#include "statusbar.h"
+
+/* Several example widgets sharing one surface, one EGL context and one main loop */
+int main(int argc, char** argv) {
+#ifdef IS_RPI
+    bcm_host_init();
+#endif
+    try {
+        Compositor compositor(0, 0, 1000, 440);
+
+        Clock clock(argc > 1 ? argv[1] : "/usr/share/fonts/truetype/freefont/FreeSansBold.ttf", 50);
+        Triangle triangle;
+        Texture texture("textures/texture256x256.png");
+        Logo logo("meshes/logo3d.obj", 1.0);
+        StatusBar status;
+
+        /* Widgets draw into the compositor's surface, each one keeps its own update rate */
+        compositor.add(&clock, 2, 0, 0);
+        compositor.add(&logo, 30, 400, 0);
+        compositor.add(&triangle, 15, 800, 0);
+        compositor.add(&texture, 20, 800, 200);
+        compositor.add(&status, 2, 0, 400);
+
+        /* Clock and status bar change once a second, the other widgets animate on every update */
+        clock.setCached(true);
+
+        compositor.run(60);
+    } catch (const std::exception& ex) {
+        fprintf(stderr, "Error: %s", ex.what());
+    }
+}
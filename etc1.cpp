@@ -0,0 +1,416 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "etc1.h"
+
+/* Values defined by OES_compressed_ETC1_RGB8_texture and the KTX specification */
+static const uint32_t GL_ETC1_RGB8 = 0x8D64;
+static const uint32_t GL_RGB_FORMAT = 0x1907;
+static const uint32_t KTX_ENDIANNESS = 0x04030201;
+static const unsigned char KTX_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+static const size_t KTX_HEADER_SIZE = 64;
+static const size_t PKM_HEADER_SIZE = 16;
+
+/* Intensity modifiers, the small and the large one of each table. Pixel index 0 adds the small one,
+   1 adds the large one, 2 and 3 subtract them */
+static const int modifiers[8][2] = {
+    { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 }
+};
+
+static inline int clamp255(int value) {
+    return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+static inline int expand4(int value) {
+    return (value << 4) | value;
+}
+
+static inline int expand5(int value) {
+    return (value << 3) | (value >> 2);
+}
+
+/* Half of a block: 8 pixels sharing base colour and modifier table */
+typedef struct {
+    int rgb[8][3];
+} subblock_t;
+
+/* Pixel positions (x * 4 + y, the order of pixel index bits) of a subblock. Not flipped block is split
+   into left and right 2x4 halves, flipped one into top and bottom 4x2 halves */
+static void subblock_positions(bool flip, int s, int positions[8]) {
+    int count = 0;
+    for( int x = 0; x < 4; ++x )
+        for( int y = 0; y < 4; ++y )
+            if( (flip ? (y >= 2) : (x >= 2)) == (s == 1) ) positions[count++] = x * 4 + y;
+}
+
+/* Best modifier table of a subblock with given base colour. Returns squared error */
+static int choose_table(const subblock_t& sub, const int base[3], int* table, int indexes[8]) {
+    int best_error = -1;
+
+    for( int t = 0; t < 8; ++t ) {
+        int error = 0;
+        int chosen[8];
+
+        for( int p = 0; p < 8; ++p ) {
+            int best_pixel = -1;
+            for( int i = 0; i < 4; ++i ) {
+                int modifier = (i & 2) ? -modifiers[t][i & 1] : modifiers[t][i & 1];
+                int pixel_error = 0;
+                for( int c = 0; c < 3; ++c ) {
+                    int d = clamp255(base[c] + modifier) - sub.rgb[p][c];
+                    pixel_error += d * d;
+                }
+                if( best_pixel < 0 || pixel_error < best_pixel ) {
+                    best_pixel = pixel_error;
+                    chosen[p] = i;
+                }
+            }
+            error += best_pixel;
+            if( best_error >= 0 && error >= best_error ) break;
+        }
+
+        if( best_error < 0 || error < best_error ) {
+            best_error = error;
+            *table = t;
+            memcpy(indexes, chosen, sizeof(chosen));
+        }
+    }
+
+    return best_error;
+}
+
+/* Block layout being tried */
+typedef struct {
+    bool flip;
+    bool differential;
+    /* Quantized base colours: 4 bits each, or 5 bits and the second one as a 3-bit delta */
+    int color[2][3];
+    int table[2];
+    int indexes[2][8];
+    int error;
+} encoding_t;
+
+/* Try both base colour encodings of given subblock split */
+static void encode_split(const subblock_t sub[2], bool flip, encoding_t* best) {
+    int average[2][3];
+    for( int s = 0; s < 2; ++s ) {
+        for( int c = 0; c < 3; ++c ) {
+            int sum = 0;
+            for( int p = 0; p < 8; ++p ) sum += sub[s].rgb[p][c];
+            average[s][c] = (sum + 4) / 8;
+        }
+    }
+
+    for( int differential = 0; differential < 2; ++differential ) {
+        encoding_t e;
+        e.flip = flip;
+        e.differential = differential;
+        e.error = 0;
+
+        for( int s = 0; s < 2; ++s ) {
+            int base[3];
+            for( int c = 0; c < 3; ++c ) {
+                if( differential ) {
+                    int q = (average[s][c] * 31 + 127) / 255;
+                    /* Second colour has to be within the 3-bit delta of the first one */
+                    if( s == 1 ) q = std::min(std::max(q, e.color[0][c] - 4), e.color[0][c] + 3);
+                    e.color[s][c] = q;
+                    base[c] = expand5(q);
+                }
+                else {
+                    e.color[s][c] = (average[s][c] + 8) / 17;
+                    base[c] = expand4(e.color[s][c]);
+                }
+            }
+            e.error += choose_table(sub[s], base, &e.table[s], e.indexes[s]);
+        }
+
+        if( best->error < 0 || e.error < best->error ) *best = e;
+    }
+}
+
+/* Compress 4x4 block of RGB pixels, 3 bytes each, row by row */
+static void encode_block(const unsigned char* rgb, unsigned char* block) {
+    encoding_t best;
+    best.error = -1;
+
+    for( int flip = 0; flip < 2; ++flip ) {
+        subblock_t sub[2];
+        for( int s = 0; s < 2; ++s ) {
+            int positions[8];
+            subblock_positions(flip, s, positions);
+            for( int p = 0; p < 8; ++p ) {
+                int x = positions[p] / 4, y = positions[p] % 4;
+                for( int c = 0; c < 3; ++c ) sub[s].rgb[p][c] = rgb[(y * 4 + x) * 3 + c];
+            }
+        }
+        encode_split(sub, flip, &best);
+    }
+
+    uint32_t high = 0, low = 0;
+    for( int c = 0; c < 3; ++c ) {
+        int byte;
+        if( best.differential ) byte = (best.color[0][c] << 3) | ((best.color[1][c] - best.color[0][c]) & 7);
+        else byte = (best.color[0][c] << 4) | best.color[1][c];
+        high |= (uint32_t) byte << (24 - c * 8);
+    }
+    high |= (best.table[0] << 5) | (best.table[1] << 2) | (best.differential ? 2 : 0) | (best.flip ? 1 : 0);
+
+    /* Pixel index: most significant bits in the upper half, least significant ones in the lower */
+    for( int s = 0; s < 2; ++s ) {
+        int positions[8];
+        subblock_positions(best.flip, s, positions);
+        for( int p = 0; p < 8; ++p ) {
+            int index = best.indexes[s][p];
+            low |= (uint32_t) (index >> 1) << (positions[p] + 16);
+            low |= (uint32_t) (index & 1) << positions[p];
+        }
+    }
+
+    for( int i = 0; i < 4; ++i ) {
+        block[i] = high >> (24 - i * 8);
+        block[i + 4] = low >> (24 - i * 8);
+    }
+}
+
+/* Decompress block into 4x4 RGB pixels, 3 bytes each, row by row */
+static void decode_block(const unsigned char* block, unsigned char* rgb) {
+    uint32_t high = ((uint32_t) block[0] << 24) | (block[1] << 16) | (block[2] << 8) | block[3];
+    uint32_t low = ((uint32_t) block[4] << 24) | (block[5] << 16) | (block[6] << 8) | block[7];
+    bool differential = high & 2;
+    bool flip = high & 1;
+    int table[2] = { (int) (high >> 5) & 7, (int) (high >> 2) & 7 };
+
+    int base[2][3];
+    for( int c = 0; c < 3; ++c ) {
+        if( differential ) {
+            int first = block[c] >> 3;
+            int delta = block[c] & 7;
+            if( delta >= 4 ) delta -= 8;
+            base[0][c] = expand5(first);
+            base[1][c] = expand5((first + delta) & 31);
+        }
+        else {
+            base[0][c] = expand4(block[c] >> 4);
+            base[1][c] = expand4(block[c] & 15);
+        }
+    }
+
+    for( int x = 0; x < 4; ++x ) {
+        for( int y = 0; y < 4; ++y ) {
+            int position = x * 4 + y;
+            int s = flip ? (y >= 2) : (x >= 2);
+            int index = (((low >> (position + 16)) & 1) << 1) | ((low >> position) & 1);
+            int modifier = (index & 2) ? -modifiers[table[s]][index & 1] : modifiers[table[s]][index & 1];
+            for( int c = 0; c < 3; ++c ) rgb[(y * 4 + x) * 3 + c] = clamp255(base[s][c] + modifier);
+        }
+    }
+}
+
+size_t etc1_data_size(size_t width, size_t height) {
+    return ((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+/* Blocks over the image edge repeat its last row and column */
+void etc1_encode_image(const unsigned char* pixels, size_t width, size_t height, size_t pixel_size, size_t stride,
+                       unsigned char* data) {
+    unsigned char rgb[4 * 4 * 3];
+
+    for( size_t by = 0; by < height; by += 4 ) {
+        for( size_t bx = 0; bx < width; bx += 4 ) {
+            for( size_t y = 0; y < 4; ++y ) {
+                const unsigned char* row = pixels + std::min(by + y, height - 1) * stride;
+                for( size_t x = 0; x < 4; ++x )
+                    memcpy(rgb + (y * 4 + x) * 3, row + std::min(bx + x, width - 1) * pixel_size, 3);
+            }
+            encode_block(rgb, data);
+            data += 8;
+        }
+    }
+}
+
+void etc1_decode_image(const unsigned char* data, size_t width, size_t height, unsigned char* pixels) {
+    unsigned char rgb[4 * 4 * 3];
+
+    for( size_t by = 0; by < height; by += 4 ) {
+        for( size_t bx = 0; bx < width; bx += 4 ) {
+            decode_block(data, rgb);
+            data += 8;
+
+            for( size_t y = 0; y < 4 && by + y < height; ++y )
+                for( size_t x = 0; x < 4 && bx + x < width; ++x )
+                    memcpy(pixels + ((by + y) * width + bx + x) * 3, rgb + (y * 4 + x) * 3, 3);
+        }
+    }
+}
+
+std::string etc1_alpha_path(const std::string& path) {
+    size_t dot = path.rfind('.');
+    size_t slash = path.rfind('/');
+    if( dot == std::string::npos || (slash != std::string::npos && dot < slash) ) return path + "_alpha";
+    return path.substr(0, dot) + "_alpha" + path.substr(dot);
+}
+
+static bool ends_with(const std::string& text, const char* suffix) {
+    size_t len = strlen(suffix);
+    return text.size() >= len && text.compare(text.size() - len, len, suffix) == 0;
+}
+
+bool is_etc1_file(const std::string& path) {
+    return ends_with(path, ".pkm") || ends_with(path, ".ktx");
+}
+
+static uint32_t read_be16(const unsigned char* p) {
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t read_u32(const unsigned char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/* Map the file and check its header */
+Etc1File::Etc1File(const std::string& path) {
+    map = MAP_FAILED;
+    map_size = 0;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if( fd < 0 ) throw std::runtime_error("Cannot open file: " + path);
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || (size_t) st.st_size < PKM_HEADER_SIZE ) {
+        close(fd);
+        throw std::runtime_error("Not an ETC1 file: " + path);
+    }
+
+    map_size = st.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( map == MAP_FAILED ) throw std::runtime_error("Cannot map file: " + path);
+
+    try {
+        const unsigned char* file = (const unsigned char*) map;
+        if( map_size >= sizeof(KTX_IDENTIFIER) && memcmp(file, KTX_IDENTIFIER, sizeof(KTX_IDENTIFIER)) == 0 )
+            parseKtx(path, file, map_size);
+        else
+            parsePkm(path, file, map_size);
+    } catch( ... ) {
+        munmap(map, map_size);
+        throw;
+    }
+}
+
+Etc1File::~Etc1File() {
+    if( map != MAP_FAILED ) munmap(map, map_size);
+}
+
+/* PKM: "PKM 10", format, padded and original size, all big-endian */
+void Etc1File::parsePkm(const std::string& path, const unsigned char* file, size_t size) {
+    if( memcmp(file, "PKM 10", 6) != 0 || read_be16(file + 6) != 0 )
+        throw std::runtime_error("Not an ETC1 file: " + path);
+
+    etc1_level_t level;
+    level.width = read_be16(file + 12);
+    level.height = read_be16(file + 14);
+    level.data = file + PKM_HEADER_SIZE;
+    level.size = etc1_data_size(level.width, level.height);
+    if( level.width == 0 || level.height == 0 || level.size > size - PKM_HEADER_SIZE )
+        throw std::runtime_error("Truncated ETC1 file: " + path);
+
+    levels.push_back(level);
+}
+
+/* KTX: fixed header, key-value data to skip, then every level prefixed with its size */
+void Etc1File::parseKtx(const std::string& path, const unsigned char* file, size_t size) {
+    if( size < KTX_HEADER_SIZE || read_u32(file + 12) != KTX_ENDIANNESS )
+        throw std::runtime_error("Unsupported KTX file: " + path);
+    if( read_u32(file + 28) != GL_ETC1_RGB8 )
+        throw std::runtime_error("Not an ETC1 file: " + path);
+
+    size_t width = read_u32(file + 36);
+    size_t height = read_u32(file + 40);
+    size_t count = std::max(read_u32(file + 56), (uint32_t) 1);
+    size_t offset = KTX_HEADER_SIZE + read_u32(file + 60);
+
+    for( size_t i = 0; i < count; ++i ) {
+        if( offset + 4 > size ) throw std::runtime_error("Truncated ETC1 file: " + path);
+
+        etc1_level_t level;
+        level.width = std::max(width >> i, (size_t) 1);
+        level.height = std::max(height >> i, (size_t) 1);
+        level.size = read_u32(file + offset);
+        level.data = file + offset + 4;
+        if( level.size != etc1_data_size(level.width, level.height) || level.size > size - offset - 4 )
+            throw std::runtime_error("Truncated ETC1 file: " + path);
+
+        levels.push_back(level);
+        offset += 4 + ((level.size + 3) & ~(size_t) 3);
+    }
+}
+
+/* Write whole file or throw */
+static void write_file(const std::string& path, const std::vector<unsigned char>& contents) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if( file == NULL ) throw std::runtime_error("Cannot create file: " + path);
+
+    bool written = fwrite(contents.data(), 1, contents.size(), file) == contents.size();
+    if( fclose(file) != 0 || ! written ) throw std::runtime_error("Cannot write file: " + path);
+}
+
+static void append_be16(std::vector<unsigned char>& out, uint32_t value) {
+    out.push_back(value >> 8);
+    out.push_back(value & 0xFF);
+}
+
+static void append_u32(std::vector<unsigned char>& out, uint32_t value) {
+    unsigned char bytes[4];
+    memcpy(bytes, &value, sizeof(bytes));
+    out.insert(out.end(), bytes, bytes + 4);
+}
+
+void write_pkm(const std::string& path, size_t width, size_t height, const std::vector<unsigned char>& data) {
+    std::vector<unsigned char> out;
+    const char* magic = "PKM 10";
+    out.insert(out.end(), magic, magic + 6);
+    append_be16(out, 0);
+    append_be16(out, (width + 3) & ~3);
+    append_be16(out, (height + 3) & ~3);
+    append_be16(out, width);
+    append_be16(out, height);
+    out.insert(out.end(), data.begin(), data.end());
+
+    write_file(path, out);
+}
+
+void write_ktx(const std::string& path, size_t width, size_t height, const std::vector<std::vector<unsigned char> >& levels) {
+    std::vector<unsigned char> out(KTX_IDENTIFIER, KTX_IDENTIFIER + sizeof(KTX_IDENTIFIER));
+    append_u32(out, KTX_ENDIANNESS);
+    append_u32(out, 0);                 /* glType: compressed */
+    append_u32(out, 1);                 /* glTypeSize */
+    append_u32(out, 0);                 /* glFormat: compressed */
+    append_u32(out, GL_ETC1_RGB8);
+    append_u32(out, GL_RGB_FORMAT);
+    append_u32(out, width);
+    append_u32(out, height);
+    append_u32(out, 0);                 /* pixelDepth */
+    append_u32(out, 0);                 /* numberOfArrayElements */
+    append_u32(out, 1);                 /* numberOfFaces */
+    append_u32(out, levels.size());
+    append_u32(out, 0);                 /* bytesOfKeyValueData */
+
+    /* ETC1 levels are multiples of 8 bytes, no padding needed */
+    for( size_t i = 0; i < levels.size(); ++i ) {
+        append_u32(out, levels[i].size());
+        out.insert(out.end(), levels[i].begin(), levels[i].end());
+    }
+
+    write_file(path, out);
+}
@@ -0,0 +1,60 @@
+#ifndef __ETC1_H__
+#define __ETC1_H__
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* ETC1 compression (OES_compressed_ETC1_RGB8_texture): every 4x4 pixel block is stored in 8 bytes,
+   RGB only. Transparent images keep their alpha in a second ETC1 image, the alpha plane, which is
+   stored next to the colour one as <name>_alpha.ktx or <name>_alpha.pkm */
+
+/* Bytes of compressed image data of given size */
+size_t etc1_data_size(size_t width, size_t height);
+
+/* Compress RGB(A) pixels, 'pixel_size' bytes each, rows 'stride' bytes apart. Alpha is ignored */
+void etc1_encode_image(const unsigned char* pixels, size_t width, size_t height, size_t pixel_size, size_t stride,
+                       unsigned char* data);
+
+/* Decompress image into RGB pixels, 3 bytes each, rows tightly packed */
+void etc1_decode_image(const unsigned char* data, size_t width, size_t height, unsigned char* pixels);
+
+/* Path of the alpha plane of an ETC1 file: image.ktx -> image_alpha.ktx */
+std::string etc1_alpha_path(const std::string& path);
+
+/* Does the path name an ETC1 container, .pkm or .ktx */
+bool is_etc1_file(const std::string& path);
+
+/* One mipmap level of a compressed image */
+typedef struct {
+    size_t width;
+    size_t height;
+    const unsigned char* data;
+    size_t size;
+} etc1_level_t;
+
+/* PKM or KTX file holding ETC1 data, read straight from its memory mapping */
+class Etc1File {
+private:
+    void* map;
+    size_t map_size;
+
+    void parsePkm(const std::string& path, const unsigned char* file, size_t size);
+    void parseKtx(const std::string& path, const unsigned char* file, size_t size);
+
+public:
+    /* Throws if the file can't be read or isn't ETC1 */
+    Etc1File(const std::string& path);
+    ~Etc1File();
+
+    /* Level 0 is the full size image. PKM-files have no mipmaps */
+    std::vector<etc1_level_t> levels;
+};
+
+/* Write single image to a PKM-file */
+void write_pkm(const std::string& path, size_t width, size_t height, const std::vector<unsigned char>& data);
+
+/* Write image and its mipmaps, if any, to a KTX-file */
+void write_ktx(const std::string& path, size_t width, size_t height, const std::vector<std::vector<unsigned char> >& levels);
+
+#endif
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "etc1.h"
+#include "etc1loader.h"
+
+#include <GLES2/gl2ext.h>
+
+#ifndef GL_ETC1_RGB8_OES
+#define GL_ETC1_RGB8_OES 0x8D64
+#endif
+
+static bool has_gl_extension(const char* name) {
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    return extensions != NULL && strstr(extensions, name) != NULL;
+}
+
+static bool is_power_of_two(size_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* Can compressed data be uploaded as it is */
+static bool etc1_supported() {
+    static int supported = -1;
+    if( supported < 0 ) {
+        supported = has_gl_extension("GL_OES_compressed_ETC1_RGB8_texture");
+        if( ! supported ) printf("ETC1 textures aren't supported by GPU, they will be decompressed\n");
+    }
+    return supported;
+}
+
+/* Create texture out of one ETC1 file */
+static GLuint upload_etc1_file(const std::string& path, const texture_options_t& options,
+                               size_t* width, size_t* height, size_t* bytes) {
+    Etc1File file(path);
+    size_t w = file.levels[0].width;
+    size_t h = file.levels[0].height;
+
+    /* Stored mipmaps are used only if the chain is complete and GLES2 allows mipmaps of this size */
+    size_t full_chain = 1;
+    for( size_t size = std::max(w, h); size > 1; size /= 2 ) full_chain += 1;
+    bool power_of_two = is_power_of_two(w) && is_power_of_two(h);
+    bool mipmaps = options.mipmaps && file.levels.size() == full_chain
+                   && (power_of_two || has_gl_extension("GL_OES_texture_npot"));
+
+    GLuint texture_id = 0;
+    glGenTextures(1, &texture_id);
+    assert(texture_id != 0);
+
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, power_of_two ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, power_of_two ? GL_REPEAT : GL_CLAMP_TO_EDGE);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
+    *bytes = 0;
+    std::vector<unsigned char> rgb;
+    for( size_t i = 0; i < (mipmaps ? file.levels.size() : 1); ++i ) {
+        const etc1_level_t& level = file.levels[i];
+
+        if( etc1_supported() ) {
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, GL_ETC1_RGB8_OES, level.width, level.height, 0, level.size, level.data);
+            *bytes += level.size;
+        }
+        else {
+            rgb.resize(level.width * level.height * 3);
+            etc1_decode_image(level.data, level.width, level.height, rgb.data());
+            glTexImage2D(GL_TEXTURE_2D, i, GL_RGB, level.width, level.height, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+            *bytes += rgb.size();
+        }
+    }
+
+    *width = w;
+    *height = h;
+    return texture_id;
+}
+
+/* Create colour texture and the alpha plane one, if the file has it */
+etc1_texture_t load_etc1_texture(const char* path, const texture_options_t& options) {
+    etc1_texture_t texture;
+    memset(&texture, 0, sizeof(texture));
+    texture.color = upload_etc1_file(path, options, &texture.width, &texture.height, &texture.bytes);
+
+    std::string alpha_path = etc1_alpha_path(path);
+    if( access(alpha_path.c_str(), F_OK) != 0 ) return texture;
+
+    try {
+        size_t width, height, bytes;
+        texture.alpha = upload_etc1_file(alpha_path, options, &width, &height, &bytes);
+        texture.bytes += bytes;
+
+        if( width != texture.width || height != texture.height ) {
+            glDeleteTextures(1, &texture.alpha);
+            throw std::runtime_error("Alpha plane size doesn't match the image: " + alpha_path);
+        }
+    } catch( ... ) {
+        glDeleteTextures(1, &texture.color);
+        throw;
+    }
+
+    return texture;
+}
@@ -0,0 +1,29 @@
+#ifndef __ETC1LOADER_H__
+#define __ETC1LOADER_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+
+#include "pngloader.h"
+
+/* ETC1 textures made by etc1pack out of PNG-files. They're uploaded as they are stored, without any
+   decoding, and take 4 bits per pixel. GPUs lacking OES_compressed_ETC1_RGB8_texture get them
+   decompressed into RGB textures */
+
+typedef struct {
+    /* Colour texture */
+    GLuint color;
+    /* Alpha plane: alpha in the colour channels of another texture, 0 for opaque images */
+    GLuint alpha;
+    size_t width;
+    size_t height;
+    /* GPU memory of both textures, mipmaps included */
+    size_t bytes;
+} etc1_texture_t;
+
+/* Create EGL textures out of an ETC1 .ktx or .pkm file and its alpha plane, if there's one.
+   Mipmaps stored in the file are used if the options ask for mipmaps. Packing is ignored */
+etc1_texture_t load_etc1_texture(const char* path, const texture_options_t& options);
+
+#endif
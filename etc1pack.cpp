@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "etc1.h"
+#include "pngloader.h"
+
+/* Converts PNG-files into ETC1 textures:
+
+   etc1pack [--no-mipmaps] image.png image.ktx
+   etc1pack image.png image.pkm
+
+   KTX-files get the whole mipmap chain unless --no-mipmaps is given, PKM-files hold one image.
+   Alpha channel of transparent images goes to the alpha plane, image_alpha.ktx or image_alpha.pkm */
+
+typedef struct {
+    size_t width;
+    size_t height;
+    /* RGBA pixels */
+    std::vector<unsigned char> pixels;
+} image_t;
+
+/* Next mipmap level */
+static image_t downscale(const image_t& image) {
+    image_t half;
+    half.width = std::max(image.width / 2, (size_t) 1);
+    half.height = std::max(image.height / 2, (size_t) 1);
+    half.pixels.resize(half.width * half.height * 4);
+    halve_image((const char*) image.pixels.data(), image.width, image.height, GL_RGBA, (char*) half.pixels.data());
+    return half;
+}
+
+/* Compress colour or alpha of the image */
+static std::vector<unsigned char> compress(const image_t& image, bool alpha) {
+    std::vector<unsigned char> data(etc1_data_size(image.width, image.height));
+
+    if( ! alpha ) {
+        etc1_encode_image(image.pixels.data(), image.width, image.height, 4, image.width * 4, data.data());
+        return data;
+    }
+
+    /* Alpha plane is a grey image */
+    std::vector<unsigned char> grey(image.width * image.height * 3);
+    for( size_t i = 0; i < image.width * image.height; ++i )
+        memset(&grey[i * 3], image.pixels[i * 4 + 3], 3);
+    etc1_encode_image(grey.data(), image.width, image.height, 3, image.width * 3, data.data());
+    return data;
+}
+
+/* Compress image and its mipmaps, write it to KTX or PKM file. Returns compressed size */
+static size_t write_image(const std::string& path, const std::vector<image_t>& chain, bool alpha) {
+    std::vector<std::vector<unsigned char> > levels;
+    size_t size = 0;
+    for( size_t i = 0; i < chain.size(); ++i ) {
+        levels.push_back(compress(chain[i], alpha));
+        size += levels.back().size();
+    }
+
+    if( path.size() > 4 && path.compare(path.size() - 4, 4, ".pkm") == 0 )
+        write_pkm(path, chain[0].width, chain[0].height, levels[0]);
+    else
+        write_ktx(path, chain[0].width, chain[0].height, levels);
+
+    return size;
+}
+
+int main(int argc, char** argv) {
+    bool mipmaps = true;
+    int arg = 1;
+    if( arg < argc && strcmp(argv[arg], "--no-mipmaps") == 0 ) {
+        mipmaps = false;
+        arg += 1;
+    }
+
+    if( argc - arg != 2 || ! is_etc1_file(argv[arg + 1]) ) {
+        fprintf(stderr, "Usage: %s [--no-mipmaps] image.png image.ktx|image.pkm\n", argv[0]);
+        return 1;
+    }
+    std::string input = argv[arg];
+    std::string output = argv[arg + 1];
+    if( output.compare(output.size() - 4, 4, ".pkm") == 0 ) mipmaps = false;
+
+    try {
+        std::vector<image_t> chain(1);
+        char* pixels = load_png_image(input.c_str(), &chain[0].width, &chain[0].height);
+        chain[0].pixels.assign(pixels, pixels + chain[0].width * chain[0].height * 4);
+        free(pixels);
+
+        while( mipmaps && (chain.back().width > 1 || chain.back().height > 1) )
+            chain.push_back(downscale(chain.back()));
+
+        bool transparent = false;
+        for( size_t i = 0; i < chain[0].width * chain[0].height && ! transparent; ++i )
+            transparent = chain[0].pixels[i * 4 + 3] != 0xFF;
+
+        size_t size = write_image(output, chain, false);
+        printf("%s: %zux%zu, %zu levels, %zu KB", output.c_str(), chain[0].width, chain[0].height, chain.size(), size / 1024);
+
+        if( transparent ) {
+            std::string alpha_path = etc1_alpha_path(output);
+            size_t alpha_size = write_image(alpha_path, chain, true);
+            printf(", alpha plane %s: %zu KB", alpha_path.c_str(), alpha_size / 1024);
+            size += alpha_size;
+        }
+        else remove(etc1_alpha_path(output).c_str());
+
+        size_t rgba_size = 0;
+        for( size_t i = 0; i < chain.size(); ++i ) rgba_size += chain[i].pixels.size();
+        printf(" (RGBA: %zu KB)\n", rgba_size / 1024);
+    } catch( const std::exception& ex ) {
+        fprintf(stderr, "Error: %s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "glstate.h"
+
+/* Forget everything, next calls go to the driver */
+void GLState::reset() {
+    program_known = false;
+    program = 0;
+
+    array_buffer_known = false;
+    element_buffer_known = false;
+    array_buffer = 0;
+    element_buffer = 0;
+
+    active_unit_known = false;
+    active_unit = 0;
+    textures_known = 0;
+    memset(textures, 0, sizeof(textures));
+
+    for( int i = 0; i < CAP_COUNT; ++i ) caps[i] = -1;
+
+    attribs_known = 0;
+    attribs_enabled = 0;
+
+    blend_func_known = false;
+    blend_src = GL_ONE;
+    blend_dst = GL_ZERO;
+
+    viewport_known = false;
+    scissor_known = false;
+    memset(viewport_box, 0, sizeof(viewport_box));
+    memset(scissor_box, 0, sizeof(scissor_box));
+
+    uniforms.clear();
+}
+
+void GLState::useProgram(GLuint id) {
+    if( !changed(program_known && program == id) ) return;
+
+    glUseProgram(id);
+    program_known = true;
+    program = id;
+}
+
+void GLState::bindBuffer(GLenum target, GLuint id) {
+    if( target == GL_ARRAY_BUFFER ) {
+        if( !changed(array_buffer_known && array_buffer == id) ) return;
+        array_buffer_known = true;
+        array_buffer = id;
+    }
+    else if( target == GL_ELEMENT_ARRAY_BUFFER ) {
+        if( !changed(element_buffer_known && element_buffer == id) ) return;
+        element_buffer_known = true;
+        element_buffer = id;
+    }
+    else issued += 1;
+
+    glBindBuffer(target, id);
+}
+
+void GLState::activeTexture(GLenum unit) {
+    GLuint index = unit - GL_TEXTURE0;
+    if( !changed(active_unit_known && active_unit == index) ) return;
+
+    glActiveTexture(unit);
+    active_unit_known = true;
+    active_unit = index;
+}
+
+void GLState::bindTexture(GLenum target, GLuint id) {
+    /* Only 2D textures on the first units are tracked */
+    bool tracked = target == GL_TEXTURE_2D && active_unit_known && active_unit < MAX_UNITS;
+    uint32_t bit = tracked ? 1u << active_unit : 0;
+
+    if( tracked ) {
+        if( !changed((textures_known & bit) && textures[active_unit] == id) ) return;
+        textures_known |= bit;
+        textures[active_unit] = id;
+    }
+    else issued += 1;
+
+    glBindTexture(target, id);
+}
+
+int GLState::capIndex(GLenum cap) {
+    switch( cap ) {
+    case GL_BLEND:        return CAP_BLEND;
+    case GL_SCISSOR_TEST: return CAP_SCISSOR_TEST;
+    case GL_DEPTH_TEST:   return CAP_DEPTH_TEST;
+    case GL_CULL_FACE:    return CAP_CULL_FACE;
+    case GL_STENCIL_TEST: return CAP_STENCIL_TEST;
+    default:              return -1;
+    }
+}
+
+void GLState::setCap(GLenum cap, bool on) {
+    int index = capIndex(cap);
+
+    if( index >= 0 ) {
+        if( !changed(caps[index] == (on ? 1 : 0)) ) return;
+        caps[index] = on ? 1 : 0;
+    }
+    else issued += 1;
+
+    if( on ) glEnable(cap);
+    else glDisable(cap);
+}
+
+void GLState::setAttrib(GLuint index, bool on) {
+    uint32_t bit = index < MAX_ATTRIBS ? 1u << index : 0;
+
+    if( bit != 0 ) {
+        if( !changed((attribs_known & bit) && ((attribs_enabled & bit) != 0) == on) ) return;
+        attribs_known |= bit;
+        if( on ) attribs_enabled |= bit;
+        else attribs_enabled &= ~bit;
+    }
+    else issued += 1;
+
+    if( on ) glEnableVertexAttribArray(index);
+    else glDisableVertexAttribArray(index);
+}
+
+void GLState::blendFunc(GLenum src, GLenum dst) {
+    if( !changed(blend_func_known && blend_src == src && blend_dst == dst) ) return;
+
+    glBlendFunc(src, dst);
+    blend_func_known = true;
+    blend_src = src;
+    blend_dst = dst;
+}
+
+void GLState::viewport(GLint vx, GLint vy, GLsizei vw, GLsizei vh) {
+    GLint box[4] = { vx, vy, vw, vh };
+    if( !changed(viewport_known && memcmp(box, viewport_box, sizeof(box)) == 0) ) return;
+
+    glViewport(vx, vy, vw, vh);
+    viewport_known = true;
+    memcpy(viewport_box, box, sizeof(box));
+}
+
+void GLState::scissor(GLint sx, GLint sy, GLsizei sw, GLsizei sh) {
+    GLint box[4] = { sx, sy, sw, sh };
+    if( !changed(scissor_known && memcmp(box, scissor_box, sizeof(box)) == 0) ) return;
+
+    glScissor(sx, sy, sw, sh);
+    scissor_known = true;
+    memcpy(scissor_box, box, sizeof(box));
+}
+
+/* Compare uniform value with the cached one and remember it. Uniform values are kept
+   by program objects, so the cache is valid until the program is relinked */
+bool GLState::uniformChanged(GLint location, const void* data, size_t size) {
+    /* Uniform isn't used by the shader */
+    if( location < 0 ) return changed(true);
+    /* Don't know which program gets the value */
+    if( !program_known ) return changed(false);
+
+    std::vector<char>& value = uniforms[((uint64_t) program << 32) | (uint32_t) location];
+    if( value.size() == size && memcmp(&value[0], data, size) == 0 ) return changed(true);
+
+    value.assign((const char*) data, (const char*) data + size);
+    return changed(false);
+}
+
+void GLState::uniform1i(GLint location, GLint value) {
+    if( uniformChanged(location, &value, sizeof(value)) ) glUniform1i(location, value);
+}
+
+void GLState::uniform1f(GLint location, GLfloat value) {
+    if( uniformChanged(location, &value, sizeof(value)) ) glUniform1f(location, value);
+}
+
+void GLState::uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) {
+    GLfloat value[4] = { v0, v1, v2, v3 };
+    if( uniformChanged(location, value, sizeof(value)) ) glUniform4f(location, v0, v1, v2, v3);
+}
+
+void GLState::uniformMatrix4fv(GLint location, const GLfloat* value) {
+    if( uniformChanged(location, value, 16 * sizeof(GLfloat)) ) glUniformMatrix4fv(location, 1, GL_FALSE, value);
+}
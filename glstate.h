@@ -0,0 +1,105 @@
+#ifndef __GLSTATE_H__
+#define __GLSTATE_H__
+
+#include <GLES2/gl2.h>
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+/* Shadow copy of GL state which skips calls that wouldn't change anything.
+   GL calls are expensive CPU-side on the Raspberry Pi driver, and widgets sharing
+   one context tend to set the same state over and over.
+
+   State is known only from the calls made through the tracker. Code which changes
+   state with plain GL calls must call reset() afterwards */
+class GLState {
+private:
+    /* Tracked capabilities */
+    typedef enum {
+        CAP_BLEND,
+        CAP_SCISSOR_TEST,
+        CAP_DEPTH_TEST,
+        CAP_CULL_FACE,
+        CAP_STENCIL_TEST,
+        CAP_COUNT
+    } cap_t;
+
+    static const int MAX_UNITS = 8;
+    static const int MAX_ATTRIBS = 32;
+
+    /* Known state. 'known' flags are false until the first call through the tracker */
+    bool program_known;
+    GLuint program;
+
+    bool array_buffer_known, element_buffer_known;
+    GLuint array_buffer, element_buffer;
+
+    bool active_unit_known;
+    GLuint active_unit;
+    uint32_t textures_known;
+    GLuint textures[MAX_UNITS];
+
+    /* -1 unknown, 0 disabled, 1 enabled */
+    int8_t caps[CAP_COUNT];
+
+    uint32_t attribs_known;
+    uint32_t attribs_enabled;
+
+    bool blend_func_known;
+    GLenum blend_src, blend_dst;
+
+    bool viewport_known, scissor_known;
+    GLint viewport_box[4], scissor_box[4];
+
+    /* Last uniform values, by program and location */
+    std::unordered_map<uint64_t, std::vector<char> > uniforms;
+
+    /* Counters of issued and skipped calls */
+    uint64_t issued;
+    uint64_t elided;
+
+    static int capIndex(GLenum cap);
+
+    void setCap(GLenum cap, bool on);
+    void setAttrib(GLuint index, bool on);
+    bool uniformChanged(GLint location, const void* data, size_t size);
+
+    bool changed(bool same) {
+        if( same ) elided += 1;
+        else issued += 1;
+        return !same;
+    }
+
+public:
+    GLState() : issued(0), elided(0) { reset(); }
+
+    /* Forget everything, next calls go to the driver */
+    void reset();
+
+    void useProgram(GLuint id);
+    void bindBuffer(GLenum target, GLuint id);
+    void activeTexture(GLenum unit);
+    void bindTexture(GLenum target, GLuint id);
+
+    void enable(GLenum cap) { setCap(cap, true); }
+    void disable(GLenum cap) { setCap(cap, false); }
+    void blendFunc(GLenum src, GLenum dst);
+
+    void enableVertexAttribArray(GLuint index) { setAttrib(index, true); }
+    void disableVertexAttribArray(GLuint index) { setAttrib(index, false); }
+
+    void viewport(GLint vx, GLint vy, GLsizei vw, GLsizei vh);
+    void scissor(GLint sx, GLint sy, GLsizei sw, GLsizei sh);
+
+    /* Uniforms of the current program. Calls with location -1 are always skipped */
+    void uniform1i(GLint location, GLint value);
+    void uniform1f(GLint location, GLfloat value);
+    void uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3);
+    void uniformMatrix4fv(GLint location, const GLfloat* value);
+
+    uint64_t getIssued() { return issued; }
+    uint64_t getElided() { return elided; }
+};
+
+#endif
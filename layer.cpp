@@ -0,0 +1,163 @@
+#include <stdio.h>
+
+#include <stdexcept>
+#include <string>
+
+#include <EGL/egl.h>
+
+#include "layer.h"
+
+/* Viewport covering quad, drawn as a triangle strip */
+static const GLfloat quad[] = {
+    -1, -1,
+    +1, -1,
+    -1, +1,
+    +1, +1,
+};
+
+/* Link layer program, quad vertices always come from attribute 0 */
+Layer::program_t Layer::createProgram(GLuint vert_shader, GLuint frag_shader) {
+    program_t result;
+
+    result.program = glCreateProgram();
+    if( result.program == 0 ) throw std::runtime_error("Cannot create layer program");
+
+    glAttachShader(result.program, vert_shader);
+    glAttachShader(result.program, frag_shader);
+    glBindAttribLocation(result.program, 0, "vertex_xy");
+    glLinkProgram(result.program);
+
+    glDeleteShader(vert_shader);
+    glDeleteShader(frag_shader);
+
+    GLint status;
+    glGetProgramiv(result.program, GL_LINK_STATUS, &status);
+    if( !status ) {
+        char log[1024];
+        GLsizei len;
+        glGetProgramInfoLog(result.program, sizeof(log), &len, log);
+        throw std::runtime_error(std::string("Cannot link layer program:\n") + log);
+    }
+    result.u_texture = glGetUniformLocation(result.program, "u_texture");
+
+    glGenBuffers(1, &result.vertex_buf);
+    glBindBuffer(GL_ARRAY_BUFFER, result.vertex_buf);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+
+    return result;
+}
+
+/* Delete layer program and its quad */
+void Layer::destroyProgram(program_t& quad) {
+    if( quad.program != 0 ) glDeleteProgram(quad.program);
+    if( quad.vertex_buf != 0 ) glDeleteBuffers(1, &quad.vertex_buf);
+
+    quad.program = 0;
+    quad.vertex_buf = 0;
+    quad.u_texture = -1;
+}
+
+Layer::Layer() {
+    fbo = 0;
+    texture = 0;
+    depth_buffer = 0;
+    stencil_buffer = 0;
+    width = 0;
+    height = 0;
+    valid = false;
+}
+
+Layer::~Layer() {
+    if( eglGetCurrentContext() != EGL_NO_CONTEXT ) destroy();
+}
+
+/* Create offscreen framebuffer */
+void Layer::init(int layer_width, int layer_height, GLbitfield buffers, bool rgb565) {
+    destroy();
+
+    width = layer_width;
+    height = layer_height;
+    valid = false;
+
+    /* Color buffer is a texture. Its size is rarely a power of two, so no mipmaps and no repeat */
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    if( rgb565 )
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, NULL);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+
+    /* Depth and stencil buffers are never sampled, renderbuffers will do */
+    if( buffers & GL_DEPTH_BUFFER_BIT ) {
+        glGenRenderbuffers(1, &depth_buffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer);
+    }
+    if( buffers & GL_STENCIL_BUFFER_BIT ) {
+        glGenRenderbuffers(1, &stencil_buffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, stencil_buffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, stencil_buffer);
+    }
+
+    GLenum complete = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if( complete != GL_FRAMEBUFFER_COMPLETE ) throw std::runtime_error("Cannot create offscreen framebuffer");
+}
+
+/* Free framebuffer and its attachments */
+void Layer::destroy() {
+    if( fbo != 0 ) glDeleteFramebuffers(1, &fbo);
+    if( texture != 0 ) glDeleteTextures(1, &texture);
+    if( depth_buffer != 0 ) glDeleteRenderbuffers(1, &depth_buffer);
+    if( stencil_buffer != 0 ) glDeleteRenderbuffers(1, &stencil_buffer);
+
+    fbo = 0;
+    texture = 0;
+    depth_buffer = 0;
+    stencil_buffer = 0;
+    width = 0;
+    height = 0;
+    valid = false;
+}
+
+/* Draw into the layer */
+void Layer::begin(GLState* gl) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    gl->viewport(0, 0, width, height);
+}
+
+/* Draw into the surface or another layer again */
+void Layer::end(Layer* target) {
+    glBindFramebuffer(GL_FRAMEBUFFER, target != NULL ? target->fbo : 0);
+    valid = true;
+}
+
+/* Draw layer texture as one quad */
+void Layer::draw(GLState* gl, const program_t& quad) {
+    gl->disable(GL_DEPTH_TEST);
+    gl->disable(GL_STENCIL_TEST);
+
+    gl->useProgram(quad.program);
+    gl->activeTexture(GL_TEXTURE0);
+    gl->bindTexture(GL_TEXTURE_2D, texture);
+    gl->uniform1i(quad.u_texture, 0);
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, quad.vertex_buf);
+    gl->enableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), 0);
+
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+    /* Widget's vertex arrays may not have that many vertices */
+    gl->disableVertexAttribArray(0);
+}
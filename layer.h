@@ -0,0 +1,73 @@
+#ifndef __LAYER_H__
+#define __LAYER_H__
+
+#include <GLES2/gl2.h>
+
+#include <atomic>
+
+#include "glstate.h"
+
+/* Offscreen framebuffer with a texture color buffer.
+
+   Drawing is redirected into the layer between begin() and end(), and the texture is
+   then drawn as one quad. Used for reduced resolution rendering, which stretches the
+   layer over the whole surface, and for caching drawing which hasn't changed: whole widgets
+   or parts of them, see EGLWidget::beginLayer() */
+class Layer {
+public:
+    /* Program and quad which draw a layer, shared by all layers of a GL context */
+    typedef struct {
+        GLuint program;
+        GLuint vertex_buf;
+        GLint u_texture;
+    } program_t;
+
+    /* Link the layer program. Takes ownership of the compiled shaders */
+    static program_t createProgram(GLuint vert_shader, GLuint frag_shader);
+    /* Delete the layer program. Its GL context must be current */
+    static void destroyProgram(program_t& quad);
+
+private:
+    /* Framebuffer and its attachments */
+    GLuint fbo;
+    GLuint texture;
+    GLuint depth_buffer;
+    GLuint stencil_buffer;
+
+    /* Layer size */
+    int width;
+    int height;
+
+    /* Texture holds what has been drawn last time */
+    std::atomic<bool> valid;
+
+public:
+    Layer();
+    /* Frees GL objects if their context is still current, otherwise they went away with it */
+    ~Layer();
+
+    /* Create framebuffer of given size with given buffers (GL_*_BUFFER_BIT mask).
+       Frees the previous one, if any */
+    void init(int layer_width, int layer_height, GLbitfield buffers, bool rgb565);
+    /* Delete framebuffer and its attachments. GL context which created them must be current */
+    void destroy();
+
+    bool isEnabled() { return fbo != 0; }
+    bool isValid() { return valid; }
+    int getWidth() { return width; }
+    int getHeight() { return height; }
+
+    /* Layer has to be drawn again. May be called from any thread */
+    void invalidate() { valid = false; }
+
+    /* Redirect drawing into the layer */
+    void begin(GLState* gl);
+    /* Drawing into the layer is done, continue drawing into target layer or into the surface if it's NULL */
+    void end(Layer* target);
+
+    /* Draw the layer texture over the current viewport. Blending and scissor are up to the caller.
+       Changes GL state, so widgets have to bind() again */
+    void draw(GLState* gl, const program_t& quad);
+};
+
+#endif
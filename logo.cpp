@@ -7,6 +7,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "logo.h"
+#include "shaders/logo_vertex.h"
+#include "shaders/logo_fragment.h"
 
 using namespace glm;
 
@@ -20,29 +22,38 @@ const char* Logo::fragmentShader() {
     return "shaders/logo_fragment.shader";
 }
 
+/* Shader sources embedded at build time */
+const char* Logo::vertexShaderSource() {
+    return logo_vertex_shader;
+}
+
+const char* Logo::fragmentShaderSource() {
+    return logo_fragment_shader;
+}
+
+/* 3D mesh needs a depth buffer */
+EGLWidget::framebuffer_t Logo::framebuffer() {
+    framebuffer_t fb = EGLWidget::framebuffer();
+    fb.depth = 16;
+    return fb;
+}
+
 /* Initialization */
 Logo::Logo(const char* file, float scale): EGLWidget(0, 0, 400, 400) {
     angle = 0.0;
     attr_pos = 0;
+    mesh_scale = scale;
+    file_name = file;
 
-    /* Load our 3d-mesh from the .obj file */
-    Mesh mesh;
-    mesh.load(file);
-
-    printf("Loaded OK\n");
-
-    /* Load vertexes and triangles data */
-    vertex_buf = mesh.genVertexBuffer();
-    triangles_buf = mesh.genTrianglesBuffer();
-
-    /* Print some statistics */
-    vertex_num = mesh.getVertexNum();
-    triangles_num = mesh.getTrianglesNum();
+    /* Mesh data isn't needed once it's in GL buffers */
+    mesh.setKeepData(false);
+}
 
-    mesh_scale = scale;
+/* Load our 3d-mesh from the .obj file on a worker thread */
+void Logo::load() {
+    mesh.load(file_name);
 
-    printf("vertex buf: %d, triangles buf: %d, vertex num: %d, triangles num: %d\n", 
-        vertex_buf, triangles_buf, vertex_num, triangles_num);
+    printf("Loaded OK\n");
 }
 
 /* Prepare widget data before entering the main loop */
@@ -50,16 +61,33 @@ void Logo::prepare() {
     /* Call parent */
     EGLWidget::prepare();
 
-    /* Create shader parameter 'pos' */
+    /* Get shader parameter 'pos' */
     attr_pos = glGetAttribLocation(program, "pos");
-    glEnableVertexAttribArray(attr_pos);
-    glVertexAttribPointer(attr_pos, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+
+    /* Load vertexes and triangles data */
+    mesh.upload();
+
+    /* Print some statistics */
+    printf("vertex num: %d, triangles num: %d, draw calls: %zu\n",
+        mesh.getVertexNum(), mesh.getTrianglesNum(), mesh.getPartNum());
 }
 
-/* Draw one frame */
-void Logo::draw() {
+/* Bind our mesh buffers */
+void Logo::bind() {
     /* Call parent */
-    EGLWidget::draw();
+    EGLWidget::bind();
+
+    /* Hide the back side of the mesh */
+    gl->enable(GL_DEPTH_TEST);
+
+    /* Mesh buffers, vertex positions go to 'pos' */
+    mesh.bind(gl, attr_pos);
+}
+
+/* Animate widget: redraw every frame */
+void Logo::update() {
+    /* Rotate our mesh */
+    angle += 0.01;
 
     /* Calculate MVP matrix */
     mat4 model;
@@ -67,15 +95,30 @@ void Logo::draw() {
     mat4 scaled = scale(rotated, vec3(mesh_scale, mesh_scale, mesh_scale));
     mat4 mvp = rotated * scaled;
 
+    /* Hand it over to draw() */
+    memcpy(state.back().mvp, glm::value_ptr(mvp), sizeof(state.back().mvp));
+    state.publish();
+
+    /* Call parent */
+    EGLWidget::update();
+}
+
+/* Draw one frame */
+void Logo::draw() {
+    /* Call parent */
+    EGLWidget::draw();
+
+    /* Take the latest state from update() */
+    state.fetch();
+
     /* Pass MVP matrix to our shader */
-    glUniformMatrix4fv(u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
-    /* Rotate our mesh */
-    angle += 0.01;
+    gl->uniformMatrix4fv(u_mvp, state.front().mvp);
 
     /* Draw the mesh */
-    glDrawElements(GL_TRIANGLES, triangles_num * 3, GL_UNSIGNED_SHORT, 0);
+    mesh.draw();
 }
 
+#ifndef EGLWIDGET_NO_MAIN
 int main(int argc, char** argv) {
 #ifdef IS_RPI
     bcm_host_init();
@@ -88,3 +131,4 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Error: %s", ex.what());
     }
 }
+#endif
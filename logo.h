@@ -2,35 +2,43 @@
 #define __LOGO_H__
 
 #include "widget.h"
+#include "triplebuffer.h"
 #include "mesh.h"
 
 /* Rotating Logo (3D-mesh) */
 class Logo: public EGLWidget {
 private:
+    /* State passed from update() to draw(), which may run on different threads */
+    typedef struct {
+        /* Model-view-projection matrix */
+        GLfloat mvp[16];
+    } state_t;
+    TripleBuffer<state_t> state;
+
     /* Rotation angle */
     GLfloat angle;
     /* Shader parameter descriptor */
     GLint attr_pos;
 
-    /* Vertex buffer */
-    GLuint vertex_buf;
-    /* Index buffer (triangles) */
-    GLuint triangles_buf;
-
-    /* Number of vertexes */
-    GLsizei vertex_num;
-    /* Number of triangles */
-    GLsizei triangles_num;
-
     /* Scale factor */
     GLfloat mesh_scale;
+
+    /* Mesh file and its data, loaded by load() */
+    const char* file_name;
+    Mesh mesh;
 public:
     Logo(const char* file, float scale);
+    virtual void load();
 
     virtual void prepare();
+    virtual void bind();
+    virtual void update();
     virtual void draw();
     virtual const char* vertexShader();
     virtual const char* fragmentShader();
+    virtual framebuffer_t framebuffer();
+    virtual const char* vertexShaderSource();
+    virtual const char* fragmentShaderSource();
 };
 
 
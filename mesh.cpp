@@ -1,86 +1,613 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <charconv>
 #include <stdexcept>
 #include <string>
-#include <fstream>
+#include <vector>
 
 #include "mesh.h"
+#include "cachefile.h"
 
-/* Load 3D-mesh .OBJ file. See: https://en.wikipedia.org/wiki/Wavefront_.obj_file */
-void Mesh::load(const char* file) {
-    /* Clear buffers */
-    vertices.clear();
-    triangles.clear();
-
-    /* Open file */
-    std::ifstream fp(file);
-    if( ! fp.is_open() ) throw std::runtime_error(std::string("Cannot open file: ") + file);
-
-    /* Read data line by line */
-    std::string line;
-    while( std::getline(fp, line) ) {
-        const char* buf = line.c_str();
-
-        switch( buf[0] ) {
-            /* Skip comments and empty lines */
-            case '#': case '\r': case '\n': 
-                break;
-
-            /* Found vertex data, read it */
-            case 'v': {
-                vertex_t v;
-                if( sscanf(buf, "v %f %f %f", &v.x, &v.y, &v.z) != 3 )
-                    throw std::runtime_error(std::string("Error reading vertex from line: ") + buf);
-                vertices.push_back(v);
+/* Binary mesh cache file: header, vertices, then triangles, both 16-byte aligned. Meshes of up to
+   65536 vertices have 16-bit indexes */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    /* 0x01020304 as written by the machine */
+    uint32_t byte_order;
+    /* GL type of indexes */
+    uint32_t index_type;
+    /* .obj file the mesh was parsed from */
+    uint64_t source_size;
+    int64_t source_mtime;
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    /* Vertex layout in floats */
+    int32_t components;
+    int32_t texcoord_offset;
+    int32_t normal_offset;
+    GLfloat bounds_min[3];
+    GLfloat bounds_max[3];
+    /* Data offsets from the beginning of the file */
+    uint32_t vertex_offset;
+    uint32_t triangle_offset;
+} mesh_cache_header_t;
+
+static const uint32_t MESH_CACHE_VERSION = 1;
+static const uint32_t MESH_CACHE_BYTE_ORDER = 0x01020304;
+
+/* Face corner: indexes of position, texture coordinates and normal, -1 if not given */
+typedef struct {
+    int32_t v;
+    int32_t vt;
+    int32_t vn;
+} corner_t;
+
+/* Data of .obj file as it's written, indexes of faces point to distinct corners */
+typedef struct {
+    std::vector<GLfloat> positions;
+    std::vector<GLfloat> texcoords;
+    std::vector<GLfloat> normals;
+    std::vector<corner_t> corners;
+    std::vector<GLuint> indexes;
+    /* Corners sharing a position are chained: the last one added for each position, the one added
+       before it for each corner, -1 at the end. Positions rarely have more than a few */
+    std::vector<int32_t> position_corner;
+    std::vector<int32_t> next_corner;
+} obj_t;
+
+static const char* skip_spaces(const char* p, const char* end) {
+    while( p < end && (*p == ' ' || *p == '\t') ) ++p;
+    return p;
+}
+
+/* Read number at 'p', return position after it or NULL if there's no number */
+static const char* parse_float(const char* p, const char* end, GLfloat* value) {
+    if( p < end && *p == '+' ) ++p;
+#if __cpp_lib_to_chars >= 201611L
+    std::from_chars_result result = std::from_chars(p, end, *value);
+    return result.ec == std::errc() ? result.ptr : NULL;
+#else
+    /* Older standard libraries parse integers only, strtof() needs a terminated string */
+    char buffer[64];
+    size_t length = 0;
+    while( p + length < end && length < sizeof(buffer) - 1 && strchr(" \t\r\n", p[length]) == NULL ) ++length;
+    memcpy(buffer, p, length);
+    buffer[length] = 0;
+    char* parsed;
+    *value = strtof(buffer, &parsed);
+    return parsed == buffer ? NULL : p + (parsed - buffer);
+#endif
+}
+
+/* Indexes are the bulk of faces, they are parsed by hand */
+static const char* parse_int(const char* p, const char* end, long* value) {
+    bool negative = p < end && *p == '-';
+    if( p < end && (*p == '-' || *p == '+') ) ++p;
+
+    const char* digits = p;
+    long result = 0;
+    while( p < end && *p >= '0' && *p <= '9' && p - digits < 9 ) result = result * 10 + (*p++ - '0');
+    if( p == digits ) return NULL;
+
+    *value = negative ? -result : result;
+    return p;
+}
+
+/* Read 'count' numbers separated by spaces, ignore the rest of the line (e.g. w of positions) */
+static bool parse_floats(const char* p, const char* end, int count, std::vector<GLfloat>& values) {
+    for( int i = 0; i < count; ++i ) {
+        GLfloat value;
+        p = parse_float(skip_spaces(p, end), end, &value);
+        if( p == NULL ) return false;
+        values.push_back(value);
+    }
+    return true;
+}
+
+/* Index of one of 'count' items. .obj indexes start at 1, negative ones count back from the last item */
+static bool resolve_index(long index, size_t count, int32_t* resolved) {
+    if( index > 0 && (size_t) index <= count ) *resolved = index - 1;
+    else if( index < 0 && (size_t) -index <= count ) *resolved = count + index;
+    else return false;
+    return true;
+}
+
+/* Read face corners v, v/vt, v//vn or v/vt/vn and triangulate the polygon as a fan */
+static bool parse_face(const char* p, const char* end, obj_t& obj) {
+    GLuint first = 0, previous = 0;
+    int count = 0;
+
+    for( p = skip_spaces(p, end); p < end; p = skip_spaces(p, end), ++count ) {
+        corner_t corner = { -1, -1, -1 };
+        long index;
+
+        if( (p = parse_int(p, end, &index)) == NULL || ! resolve_index(index, obj.positions.size() / 3, &corner.v) )
+            return false;
+        if( p < end && *p == '/' ) {
+            if( ++p < end && *p != '/' ) {
+                if( (p = parse_int(p, end, &index)) == NULL || ! resolve_index(index, obj.texcoords.size() / 2, &corner.vt) )
+                    return false;
             }
-            break;
-
-            /* Found triangle data. Note: in .OBJ file format indexes start at 1, so we take that
-               in consideration */
-            case 'f': {
-                triangle_t t;
-                if( sscanf(buf, "f %hu %hu %hu", &t.a, &t.b, &t.c) != 3 )
-                    throw std::runtime_error(std::string("Error reading face from line: ") + buf);
-                t.a -= 1; t.b -= 1; t.c -= 1;
-                triangles.push_back(t);
+            if( p < end && *p == '/' ) {
+                if( (p = parse_int(p + 1, end, &index)) == NULL || ! resolve_index(index, obj.normals.size() / 3, &corner.vn) )
+                    return false;
             }
-            break;
         }
+        if( p < end && *p != ' ' && *p != '\t' ) return false;
+
+        /* Same corner in other faces is the same vertex */
+        if( obj.position_corner.size() <= (size_t) corner.v ) obj.position_corner.resize(obj.positions.size() / 3, -1);
+        int32_t vertex = obj.position_corner[corner.v];
+        while( vertex >= 0 && (obj.corners[vertex].vt != corner.vt || obj.corners[vertex].vn != corner.vn) )
+            vertex = obj.next_corner[vertex];
+        if( vertex < 0 ) {
+            vertex = obj.corners.size();
+            obj.corners.push_back(corner);
+            obj.next_corner.push_back(obj.position_corner[corner.v]);
+            obj.position_corner[corner.v] = vertex;
+        }
+
+        if( count == 0 ) first = vertex;
+        if( count >= 2 ) {
+            obj.indexes.push_back(first);
+            obj.indexes.push_back(previous);
+            obj.indexes.push_back(vertex);
+        }
+        previous = vertex;
+    }
+
+    return count >= 3;
+}
+
+/* Parse mapped .obj file */
+static void parse_obj(const char* file, const char* data, size_t size, obj_t& obj) {
+    const char* end = data + size;
+    size_t line_number = 1;
+
+    for( const char* p = data; p < end; ++line_number ) {
+        const char* line_end = (const char*) memchr(p, '\n', end - p);
+        if( line_end == NULL ) line_end = end;
+        const char* eol = line_end;
+        if( eol > p && eol[-1] == '\r' ) --eol;
+
+        const char* keyword = skip_spaces(p, eol);
+        const char* rest = keyword;
+        while( rest < eol && *rest != ' ' && *rest != '\t' ) ++rest;
+        size_t length = rest - keyword;
+
+        bool ok = true;
+        const char* what = NULL;
+        if( length == 1 && keyword[0] == 'v' ) {
+            ok = parse_floats(rest, eol, 3, obj.positions);
+            what = "vertex";
+        }
+        else if( length == 2 && keyword[0] == 'v' && keyword[1] == 't' ) {
+            /* Third coordinate of 3D textures is dropped */
+            ok = parse_floats(rest, eol, 2, obj.texcoords);
+            what = "texture coordinates";
+        }
+        else if( length == 2 && keyword[0] == 'v' && keyword[1] == 'n' ) {
+            ok = parse_floats(rest, eol, 3, obj.normals);
+            what = "normal";
+        }
+        else if( length == 1 && keyword[0] == 'f' ) {
+            ok = parse_face(rest, eol, obj);
+            what = "face";
+        }
+        /* Comments, objects, groups, materials, smoothing groups, lines and points are skipped */
+
+        if( ! ok )
+            throw std::runtime_error(std::string("Error reading ") + what + " from line " + std::to_string(line_number) +
+                                     " of " + file + ": " + std::string(p, eol));
+
+        p = line_end + 1;
     }
+}
 
-    printf("Loaded %zu vertices, %zu triangles\n", vertices.size(), triangles.size());
+Mesh::Mesh() {
+    map = NULL;
+    map_size = 0;
+    vertex_data = NULL;
+    index_data = NULL;
+    index_type = GL_UNSIGNED_INT;
+    vertex_num = 0;
+    triangles_num = 0;
+    keep_data = true;
+    vertex_buf = 0;
+    index_buf = 0;
+    draw_index_type = GL_UNSIGNED_SHORT;
+    position_attr = -1;
+    texcoord_attr = -1;
+    normal_attr = -1;
+    components = 3;
+    texcoord_offset = -1;
+    normal_offset = -1;
+    memset(bounds_min, 0, sizeof(bounds_min));
+    memset(bounds_max, 0, sizeof(bounds_max));
 }
 
-/* Load vertex data into EGL buffer */
-GLuint Mesh::genVertexBuffer() {
-    /* Create buffer and bind it */
-    GLuint buf_id;
-    glGenBuffers(1, &buf_id);
-    glBindBuffer(GL_ARRAY_BUFFER, buf_id);
+Mesh::~Mesh() {
+    freeData();
+}
 
-    /* Load vertex data into EGL buffer */
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertex_t), &vertices[0], GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-    return buf_id;
+/* Drop vertices, indexes and the cache mapping */
+void Mesh::freeData() {
+    std::vector<GLfloat>().swap(vertices);
+    std::vector<GLuint>().swap(indexes);
+    if( map != NULL ) munmap(map, map_size);
+    map = NULL;
+    map_size = 0;
+    vertex_data = NULL;
+    index_data = NULL;
 }
 
-/* Load index (triangle) data into EGL buffer */
-GLuint Mesh::genTrianglesBuffer() {
-    /* Create buffer */
-    GLuint buf_id;
-    glGenBuffers(1, &buf_id);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buf_id);
+/* Load mesh from the cache, if it's there and up to date, or from the .obj file */
+void Mesh::load(const char* file) {
+    freeData();
+    vertex_num = 0;
+    triangles_num = 0;
+    parts.clear();
+    memset(bounds_min, 0, sizeof(bounds_min));
+    memset(bounds_max, 0, sizeof(bounds_max));
+
+    struct stat st;
+    if( stat(file, &st) != 0 ) throw std::runtime_error(std::string("Cannot open file: ") + file);
+    uint64_t source_size = st.st_size;
+    int64_t source_mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+    /* Cache file is named after the hash of the absolute .obj path */
+    std::string dir = cache_directory("EGLWIDGET_MESH_CACHE");
+    std::string cache;
+    if( ! dir.empty() ) {
+        char* absolute = realpath(file, NULL);
+        const char* source = absolute != NULL ? absolute : file;
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.mesh", (unsigned long long) fnv1a(FNV1A_SEED, source, strlen(source)));
+        free(absolute);
+        cache = dir + name;
+
+        if( loadCache(cache, source_size, source_mtime) ) {
+            printf("Mesh cache: loaded %s, %d vertices, %d triangles\n", cache.c_str(), vertex_num, triangles_num);
+            return;
+        }
+    }
+
+    parse(file);
 
-    /* Load indexes (triangles) into buffer */
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, triangles.size() * sizeof(triangle_t), &triangles[0], GL_STATIC_DRAW);
-    return buf_id;
+    if( ! cache.empty() ) storeCache(cache, source_size, source_mtime);
 }
 
-GLsizei Mesh::getVertexNum() {
-    return vertices.size();
+/* Check that all 'count' indexes are below 'vertex_count' */
+template<typename index_t>
+static bool indexes_in_range(const index_t* indexes, size_t count, uint32_t vertex_count) {
+    index_t largest = 0;
+    for( size_t i = 0; i < count; ++i ) largest = std::max(largest, indexes[i]);
+    return count == 0 || largest < vertex_count;
 }
 
-GLsizei Mesh::getTrianglesNum() {
-    return triangles.size();
+/* Map cache file and check it describes the current .obj file */
+bool Mesh::loadCache(const std::string& path, uint64_t source_size, int64_t source_mtime) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if( fd < 0 ) return false;
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(mesh_cache_header_t) ) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void* cache_map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if( cache_map == MAP_FAILED ) return false;
+
+    const mesh_cache_header_t* header = (const mesh_cache_header_t*) cache_map;
+    if( memcmp(header->magic, "EGLM", 4) != 0 || header->version != MESH_CACHE_VERSION
+     || header->byte_order != MESH_CACHE_BYTE_ORDER
+     || header->source_size != source_size || header->source_mtime != source_mtime ) {
+        printf("Mesh cache: %s is outdated\n", path.c_str());
+        munmap(cache_map, size);
+        return false;
+    }
+
+    /* Sizes are checked by division, products of header fields may wrap size_t on 32-bit systems */
+    size_t index_size = header->index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    bool layout = (header->components == 3 || header->components == 5 || header->components == 6 || header->components == 8)
+               && header->texcoord_offset >= -1 && header->texcoord_offset + 2 <= header->components
+               && header->normal_offset >= -1 && header->normal_offset + 3 <= header->components;
+    bool counts = header->vertex_count <= INT_MAX && header->triangle_count <= INT_MAX / 3
+               && header->index_type == (header->vertex_count > 0x10000 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT);
+    bool valid = layout && counts && header->vertex_offset <= size && header->triangle_offset <= size
+              && header->vertex_offset % 4 == 0 && header->triangle_offset % index_size == 0
+              && header->vertex_count <= (size - header->vertex_offset) / (header->components * sizeof(GLfloat))
+              && header->triangle_count <= (size - header->triangle_offset) / (3 * index_size);
+
+    /* Every index must point at a vertex, split() and the GPU trust them */
+    if( valid ) {
+        const char* triangles = (const char*) cache_map + header->triangle_offset;
+        size_t index_count = (size_t) header->triangle_count * 3;
+        valid = header->index_type == GL_UNSIGNED_SHORT
+              ? indexes_in_range((const GLushort*) triangles, index_count, header->vertex_count)
+              : indexes_in_range((const GLuint*) triangles, index_count, header->vertex_count);
+    }
+
+    if( ! valid ) {
+        printf("Mesh cache: invalid file %s\n", path.c_str());
+        munmap(cache_map, size);
+        unlink(path.c_str());
+        return false;
+    }
+
+    map = cache_map;
+    map_size = size;
+    vertex_data = (const GLfloat*) ((const char*) map + header->vertex_offset);
+    index_data = (const char*) map + header->triangle_offset;
+    index_type = header->index_type;
+    vertex_num = header->vertex_count;
+    triangles_num = header->triangle_count;
+    components = header->components;
+    texcoord_offset = header->texcoord_offset;
+    normal_offset = header->normal_offset;
+    memcpy(bounds_min, header->bounds_min, sizeof(bounds_min));
+    memcpy(bounds_max, header->bounds_max, sizeof(bounds_max));
+
+    /* Pages are read ahead while the GL thread gets ready to upload them */
+    madvise(map, map_size, MADV_WILLNEED);
+    return true;
 }
 
+/* Save parsed mesh */
+void Mesh::storeCache(const std::string& path, uint64_t source_size, int64_t source_mtime) {
+    mesh_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "EGLM", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.byte_order = MESH_CACHE_BYTE_ORDER;
+    header.index_type = vertex_num > 0x10000 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.vertex_count = vertex_num;
+    header.triangle_count = triangles_num;
+    header.components = components;
+    header.texcoord_offset = texcoord_offset;
+    header.normal_offset = normal_offset;
+    memcpy(header.bounds_min, bounds_min, sizeof(bounds_min));
+    memcpy(header.bounds_max, bounds_max, sizeof(bounds_max));
 
+    size_t vertex_bytes = vertices.size() * sizeof(GLfloat);
+    size_t index_size = header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    size_t triangle_bytes = indexes.size() * index_size;
+    header.vertex_offset = (sizeof(header) + 15) & ~15;
+    header.triangle_offset = (header.vertex_offset + vertex_bytes + 15) & ~15;
+
+    std::vector<char> data(header.triangle_offset + triangle_bytes);
+    memcpy(&data[0], &header, sizeof(header));
+    if( vertex_bytes > 0 ) memcpy(&data[header.vertex_offset], vertices.data(), vertex_bytes);
+    if( header.index_type == GL_UNSIGNED_INT ) {
+        if( triangle_bytes > 0 ) memcpy(&data[header.triangle_offset], indexes.data(), triangle_bytes);
+    }
+    else {
+        GLushort* short_indexes = (GLushort*) &data[header.triangle_offset];
+        for( size_t i = 0; i < indexes.size(); ++i ) short_indexes[i] = indexes[i];
+    }
+
+    std::string dir = path.substr(0, path.rfind('/'));
+    if( write_cache_file(dir, path, data) ) printf("Mesh cache: saved %s\n", path.c_str());
+}
+
+/* Parse 3D-mesh .OBJ file. See: https://en.wikipedia.org/wiki/Wavefront_.obj_file
+   The file is parsed straight from its memory mapping */
+void Mesh::parse(const char* file) {
+    /* Map file */
+    int fd = open(file, O_RDONLY);
+    if( fd < 0 ) throw std::runtime_error(std::string("Cannot open file: ") + file);
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 ) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read file: ") + file);
+    }
+
+    size_t size = st.st_size;
+    void* file_map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+    close(fd);
+    if( file_map == MAP_FAILED ) throw std::runtime_error(std::string("Cannot map file: ") + file);
+    if( file_map != NULL ) madvise(file_map, size, MADV_SEQUENTIAL);
+
+    obj_t obj;
+    try {
+        parse_obj(file, (const char*) file_map, size, obj);
+    } catch( ... ) {
+        if( file_map != NULL ) munmap(file_map, size);
+        throw;
+    }
+    if( file_map != NULL ) munmap(file_map, size);
+
+    /* Vertex layout: attributes any corner refers to. Corners without them get zeroes */
+    bool has_texcoords = false, has_normals = false;
+    for( size_t i = 0; i < obj.corners.size(); ++i ) {
+        has_texcoords |= obj.corners[i].vt >= 0;
+        has_normals |= obj.corners[i].vn >= 0;
+    }
+    components = 3;
+    texcoord_offset = has_texcoords ? components : -1;
+    components += has_texcoords ? 2 : 0;
+    normal_offset = has_normals ? components : -1;
+    components += has_normals ? 3 : 0;
+
+    /* Interleave attributes of distinct corners */
+    vertices.assign(obj.corners.size() * components, 0);
+    for( size_t i = 0; i < obj.corners.size(); ++i ) {
+        const corner_t& corner = obj.corners[i];
+        GLfloat* vertex = &vertices[i * components];
+        memcpy(vertex, &obj.positions[corner.v * 3], 3 * sizeof(GLfloat));
+        if( corner.vt >= 0 ) memcpy(vertex + texcoord_offset, &obj.texcoords[corner.vt * 2], 2 * sizeof(GLfloat));
+        if( corner.vn >= 0 ) memcpy(vertex + normal_offset, &obj.normals[corner.vn * 3], 3 * sizeof(GLfloat));
+
+        for( int c = 0; c < 3; ++c ) {
+            bounds_min[c] = i == 0 ? vertex[c] : std::min(bounds_min[c], vertex[c]);
+            bounds_max[c] = i == 0 ? vertex[c] : std::max(bounds_max[c], vertex[c]);
+        }
+    }
+
+    indexes.swap(obj.indexes);
+
+    vertex_data = vertices.data();
+    index_data = indexes.data();
+    index_type = GL_UNSIGNED_INT;
+    vertex_num = obj.corners.size();
+    triangles_num = indexes.size() / 3;
+
+    printf("Loaded %d vertices, %d triangles\n", vertex_num, triangles_num);
+}
+
+/* Index 'i' of the mesh */
+static inline GLuint index_at(const void* data, GLenum type, size_t i) {
+    return type == GL_UNSIGNED_SHORT ? ((const GLushort*) data)[i] : ((const GLuint*) data)[i];
+}
+
+/* Split the mesh into parts of at most 65536 vertices, keeping triangle order. Vertices shared
+   by triangles of different parts are copied to each of them */
+void Mesh::split(std::vector<GLfloat>& split_vertices, std::vector<GLushort>& split_indexes) {
+    /* Vertex index in the current part, -1 if it isn't there yet */
+    std::vector<GLint> part_vertex(vertex_num, -1);
+    std::vector<GLuint> used;
+    part_t part = { 0, 0, 0 };
+
+    for( GLsizei t = 0; t < triangles_num; ++t ) {
+        GLuint triangle[3];
+        for( int k = 0; k < 3; ++k ) triangle[k] = index_at(index_data, index_type, t * 3 + k);
+
+        /* Vertices the triangle adds to the part, those repeated by degenerate triangles count once */
+        size_t added = 0;
+        for( int k = 0; k < 3; ++k ) {
+            bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k == 2 && triangle[2] == triangle[1]);
+            if( part_vertex[triangle[k]] < 0 && ! repeated ) added += 1;
+        }
+
+        /* Start next part when the triangle doesn't fit */
+        if( used.size() + added > 0x10000 ) {
+            parts.push_back(part);
+            for( size_t i = 0; i < used.size(); ++i ) part_vertex[used[i]] = -1;
+            used.clear();
+            part.vertex_offset = split_vertices.size() * sizeof(GLfloat);
+            part.index_offset = split_indexes.size() * sizeof(GLushort);
+            part.index_count = 0;
+        }
+
+        for( int k = 0; k < 3; ++k ) {
+            GLuint vertex = triangle[k];
+            if( part_vertex[vertex] < 0 ) {
+                part_vertex[vertex] = used.size();
+                used.push_back(vertex);
+                split_vertices.insert(split_vertices.end(), vertex_data + vertex * components, vertex_data + (vertex + 1) * components);
+            }
+            split_indexes.push_back(part_vertex[vertex]);
+        }
+        part.index_count += 3;
+    }
+    parts.push_back(part);
+}
+
+/* Load vertices and indexes into GL buffers */
+void Mesh::upload() {
+    /* Index type GPU supports */
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    const char* env = getenv("EGLWIDGET_INDEX_UINT");
+    bool index_uint = extensions != NULL && strstr(extensions, "GL_OES_element_index_uint") != NULL
+                   && (env == NULL || strcmp(env, "0") != 0);
+
+    std::vector<GLfloat> split_vertices;
+    std::vector<GLushort> short_indexes;
+    const void* vertices_to_upload = vertex_data;
+    size_t vertex_bytes = (size_t) vertex_num * getStride();
+    const void* indexes_to_upload = index_data;
+    size_t index_bytes = (size_t) triangles_num * 3 * (index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+
+    parts.clear();
+    if( vertex_num > 0x10000 && index_uint ) {
+        /* Whole mesh with 32-bit indexes, which it has when that big */
+        draw_index_type = GL_UNSIGNED_INT;
+        parts.push_back((part_t) { 0, 0, triangles_num * 3 });
+    }
+    else if( vertex_num > 0x10000 ) {
+        split(split_vertices, short_indexes);
+        draw_index_type = GL_UNSIGNED_SHORT;
+        vertices_to_upload = split_vertices.data();
+        vertex_bytes = split_vertices.size() * sizeof(GLfloat);
+        indexes_to_upload = short_indexes.data();
+        index_bytes = short_indexes.size() * sizeof(GLushort);
+        printf("Mesh of %d vertices split into %zu parts\n", vertex_num, parts.size());
+    }
+    else {
+        /* Parsed meshes have 32-bit indexes, cached ones of this size 16-bit already */
+        draw_index_type = GL_UNSIGNED_SHORT;
+        parts.push_back((part_t) { 0, 0, triangles_num * 3 });
+        if( index_type == GL_UNSIGNED_INT ) {
+            short_indexes.assign((const GLuint*) index_data, (const GLuint*) index_data + triangles_num * 3);
+            indexes_to_upload = short_indexes.data();
+            index_bytes = short_indexes.size() * sizeof(GLushort);
+        }
+    }
+
+    glGenBuffers(1, &vertex_buf);
+    glBindBuffer(GL_ARRAY_BUFFER, vertex_buf);
+    glBufferData(GL_ARRAY_BUFFER, vertex_bytes, vertices_to_upload, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &index_buf);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, indexes_to_upload, GL_STATIC_DRAW);
+
+    if( ! keep_data ) freeData();
+}
+
+/* Point attributes at vertices starting at given byte offset */
+void Mesh::setAttribPointers(size_t vertex_offset) {
+    const char* base = (const char*) vertex_offset;
+    glVertexAttribPointer(position_attr, 3, GL_FLOAT, GL_FALSE, getStride(), base);
+    if( texcoord_attr >= 0 && texcoord_offset >= 0 )
+        glVertexAttribPointer(texcoord_attr, 2, GL_FLOAT, GL_FALSE, getStride(), base + getTexCoordOffset());
+    if( normal_attr >= 0 && normal_offset >= 0 )
+        glVertexAttribPointer(normal_attr, 3, GL_FLOAT, GL_FALSE, getStride(), base + getNormalOffset());
+}
+
+/* Bind buffers and set up attributes. Attributes the mesh doesn't have are left disabled */
+void Mesh::bind(GLState* gl, GLint position, GLint texcoord, GLint normal) {
+    position_attr = position;
+    texcoord_attr = texcoord;
+    normal_attr = normal;
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, vertex_buf);
+    gl->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+
+    gl->enableVertexAttribArray(position);
+    if( texcoord >= 0 && texcoord_offset >= 0 ) gl->enableVertexAttribArray(texcoord);
+    if( normal >= 0 && normal_offset >= 0 ) gl->enableVertexAttribArray(normal);
+    setAttribPointers(0);
+}
+
+/* Draw all parts. Attributes of split meshes are pointed at each part's vertices, which GLES2 can't
+   offset otherwise */
+void Mesh::draw() {
+    for( size_t i = 0; i < parts.size(); ++i ) {
+        if( parts.size() > 1 ) setAttribPointers(parts[i].vertex_offset);
+        glDrawElements(GL_TRIANGLES, parts[i].index_count, draw_index_type, (const GLvoid*) parts[i].index_offset);
+    }
+}
+
+GLsizei Mesh::getVertexNum() {
+    return vertex_num;
+}
+
+GLsizei Mesh::getTrianglesNum() {
+    return triangles_num;
+}
@@ -5,44 +5,113 @@
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
+#include <stdint.h>
+#include <string>
 #include <vector>
 
-/* Simple 3D mesh */
+#include "glstate.h"
+
+/* Simple 3D mesh.
+
+   Meshes of more than 65536 vertices are drawn with 32-bit indexes if the GPU supports
+   GL_OES_element_index_uint, otherwise they are split into parts small enough for 16-bit ones.
+
+   Parsed .obj files are saved to a binary cache, which later loads map and upload as they are.
+   A cached mesh is rebuilt when size or modification time of its .obj file changes.
+   Cache directory: $EGLWIDGET_MESH_CACHE, $XDG_CACHE_HOME/eglwidgets or ~/.cache/eglwidgets.
+   Invalid cache files are deleted and the .obj file is parsed again.
+   Set EGLWIDGET_MESH_CACHE to an empty string to disable the cache */
 class Mesh {
 private:
-    /* Vertex */
+    /* Range of vertices and indexes drawn with one call */
     typedef struct {
-        GLfloat x;
-        GLfloat y;
-        GLfloat z;
-    } vertex_t;
+        /* Byte offsets of the first vertex and index */
+        size_t vertex_offset;
+        size_t index_offset;
+        GLsizei index_count;
+    } part_t;
 
-    /* Triangle */
-    typedef struct {
-        GLushort a;
-        GLushort b;
-        GLushort c;
-    } triangle_t;
+    /* Parsed data: interleaved vertices x, y, z, then s, t and normal x, y, z if the mesh has them,
+       3 indexes per triangle */
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indexes;
+
+    /* Mapped cache file, NULL if the mesh has been parsed */
+    void* map;
+    size_t map_size;
+
+    /* Data to upload, in the vectors or in the mapping. NULL once uploaded unless the data is kept.
+       Indexes are GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+    const GLfloat* vertex_data;
+    const void* index_data;
+    GLenum index_type;
+    GLsizei vertex_num;
+    GLsizei triangles_num;
+    bool keep_data;
+
+    /* Floats per vertex and offsets of texture coordinates and normals in them, -1 if there are none */
+    int components;
+    int texcoord_offset;
+    int normal_offset;
 
-    /* Buffers to store 3d-data */
-    std::vector<vertex_t> vertices;
-    std::vector<triangle_t> triangles;
+    /* GL buffers, type of indexes in them and parts to draw */
+    GLuint vertex_buf;
+    GLuint index_buf;
+    GLenum draw_index_type;
+    std::vector<part_t> parts;
+
+    /* Attribute locations given to bind() */
+    GLint position_attr;
+    GLint texcoord_attr;
+    GLint normal_attr;
+
+    /* Bounding box */
+    GLfloat bounds_min[3];
+    GLfloat bounds_max[3];
+
+    void parse(const char* file);
+    bool loadCache(const std::string& path, uint64_t source_size, int64_t source_mtime);
+    void storeCache(const std::string& path, uint64_t source_size, int64_t source_mtime);
+    void freeData();
+    void split(std::vector<GLfloat>& split_vertices, std::vector<GLushort>& split_indexes);
+    void setAttribPointers(size_t vertex_offset);
 
 public:
-    Mesh() {}
-    virtual ~Mesh() {}
+    Mesh();
+    virtual ~Mesh();
 
-    /* Load mesh from a file */
+    /* Load mesh from a Wavefront .obj file: positions, texture coordinates and normals, polygons
+       get triangulated. May be called from any thread */
     void load(const char* file);
 
-    /* Load vertex data into EGL buffer */
-    GLuint genVertexBuffer();
-    /* Load index (triangle) data into EGL buffer */
-    GLuint genTrianglesBuffer();
+    /* Free vertices and indexes once upload() has put them into GL buffers. Counts, layout and bounds stay.
+       Data is kept by default */
+    void setKeepData(bool keep) { keep_data = keep; }
+
+    /* Load vertices and indexes into GL buffers, splitting the mesh if needed */
+    void upload();
+
+    /* Bind buffers and point attributes at position, texture coordinates and normal of vertices.
+       Pass -1 for attributes the shader doesn't have */
+    void bind(GLState* gl, GLint position, GLint texcoord = -1, GLint normal = -1);
+    /* Draw all triangles, part by part. Call bind() first */
+    void draw();
 
     /* Number of vertices/triangles */
     GLsizei getVertexNum();
     GLsizei getTrianglesNum();
+    /* Number of draw calls, more than 1 for split meshes. Known after upload() */
+    size_t getPartNum() { return parts.size(); }
+
+    /* Vertex size in bytes */
+    GLsizei getStride() { return components * sizeof(GLfloat); }
+    /* Byte offsets of texture coordinates and normals in a vertex, -1 if the mesh has none */
+    int getTexCoordOffset() { return texcoord_offset < 0 ? -1 : texcoord_offset * (int) sizeof(GLfloat); }
+    int getNormalOffset() { return normal_offset < 0 ? -1 : normal_offset * (int) sizeof(GLfloat); }
+
+    /* Corners of the box around all vertices, x, y, z each */
+    const GLfloat* getBoundsMin() { return bounds_min; }
+    const GLfloat* getBoundsMax() { return bounds_max; }
 };
 
 
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdexcept>
+
+#include "metrics.h"
+
+Histogram::Histogram() {
+    for( int i = 0; i < BUCKETS; ++i ) buckets[i] = 0;
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+/* Values below 2^(SUB_BITS+1) have their own buckets. Larger values keep SUB_BITS bits
+   after the leading one: bucket = shift * SUB_BUCKETS + (value >> shift) */
+int Histogram::bucketIndex(uint64_t value) {
+    if( value >= (1ULL << MAX_BITS) ) value = (1ULL << MAX_BITS) - 1;
+    if( value < (uint64_t) 2 * SUB_BUCKETS ) return value;
+
+    int bits = 64 - __builtin_clzll(value);
+    int shift = bits - SUB_BITS - 1;
+
+    return shift * SUB_BUCKETS + (value >> shift);
+}
+
+/* Smallest value which falls into given bucket */
+uint64_t Histogram::bucketValue(int index) {
+    if( index < 2 * SUB_BUCKETS ) return index;
+
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t top = index % SUB_BUCKETS + SUB_BUCKETS;
+
+    return top << shift;
+}
+
+/* Add one sample */
+void Histogram::record(uint64_t value) {
+    buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    /* New maximum is rare, so the loop almost never runs */
+    uint64_t current = max.load(std::memory_order_relaxed);
+    while( value > current && ! max.compare_exchange_weak(current, value, std::memory_order_relaxed) );
+}
+
+/* Value at given quantile */
+uint64_t Histogram::quantile(double q) {
+    uint64_t total = count.load(std::memory_order_relaxed);
+    if( total == 0 ) return 0;
+
+    uint64_t rank = (uint64_t) (q * total);
+    if( rank >= total ) rank = total - 1;
+
+    uint64_t seen = 0;
+    for( int i = 0; i < BUCKETS; ++i ) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if( seen > rank ) return bucketValue(i);
+    }
+
+    return max;
+}
+
+/* Start listening */
+Metrics::Metrics(const char* socket_path) {
+    frames = 0;
+    overruns = 0;
+    idle = 0;
+    gl_issued = 0;
+    gl_elided = 0;
+    path = socket_path;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if( path.size() >= sizeof(addr.sun_path) ) throw std::runtime_error("Metrics socket path is too long: " + path);
+    strcpy(addr.sun_path, socket_path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( listen_fd < 0 ) throw std::runtime_error("Cannot create metrics socket");
+
+    /* Socket may be left over from a previous run */
+    unlink(socket_path);
+
+    if( bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0 ) {
+        close(listen_fd);
+        throw std::runtime_error("Cannot listen on metrics socket: " + path);
+    }
+
+    printf("Serving metrics on %s\n", socket_path);
+}
+
+Metrics::~Metrics() {
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+/* Serve waiting clients. Listening socket is non-blocking, so this returns at once if there are none */
+void Metrics::serve() {
+    int fd;
+    while( (fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) >= 0 ) {
+        /* Metrics fit into the socket buffer, a client which doesn't read must not block us */
+        std::string text = format();
+        if( send(fd, text.data(), text.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 ) perror("Cannot send metrics");
+
+        close(fd);
+    }
+}
+
+/* Metrics in Prometheus text format, durations in seconds */
+std::string Metrics::format() {
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+    std::string text;
+    char line[256];
+
+    snprintf(line, sizeof(line),
+             "eglwidget_frames_total %llu\n"
+             "eglwidget_overruns_total %llu\n"
+             "eglwidget_idle_wakeups_total %llu\n"
+             "eglwidget_gl_calls_total{result=\"issued\"} %llu\n"
+             "eglwidget_gl_calls_total{result=\"elided\"} %llu\n",
+             (unsigned long long) frames, (unsigned long long) overruns, (unsigned long long) idle,
+             (unsigned long long) gl_issued, (unsigned long long) gl_elided);
+    text += line;
+
+    for( int i = 0; i < FrameStats::PHASE_COUNT; ++i ) {
+        Histogram& h = phases[i];
+        const char* name = FrameStats::phaseName((FrameStats::phase_t) i);
+
+        for( size_t j = 0; j < sizeof(quantiles) / sizeof(quantiles[0]); ++j ) {
+            snprintf(line, sizeof(line), "eglwidget_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n",
+                     name, quantiles[j], h.quantile(quantiles[j]) / 1e9);
+            text += line;
+        }
+
+        snprintf(line, sizeof(line),
+                 "eglwidget_phase_seconds_max{phase=\"%s\"} %.9f\n"
+                 "eglwidget_phase_seconds_sum{phase=\"%s\"} %.9f\n"
+                 "eglwidget_phase_seconds_count{phase=\"%s\"} %llu\n",
+                 name, h.getMax() / 1e9, name, h.getSum() / 1e9, name, (unsigned long long) h.getCount());
+        text += line;
+    }
+
+    return text;
+}
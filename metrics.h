@@ -0,0 +1,79 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+
+#include "stats.h"
+
+/* Lock-free log-linear (HDR-style) histogram of durations in nanoseconds.
+   Every power of two is split into 16 linear sub-buckets, so any recorded value
+   is off by no more than 1/16 (6%). Recording is three relaxed atomic additions */
+class Histogram {
+private:
+    /* Sub-buckets per power of two: 2^SUB_BITS */
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    /* Largest tracked value is 2^MAX_BITS ns (~18 minutes), larger values are clamped */
+    static const int MAX_BITS = 40;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS) * SUB_BUCKETS + 2 * SUB_BUCKETS;
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    static int bucketIndex(uint64_t value);
+    static uint64_t bucketValue(int index);
+
+public:
+    Histogram();
+
+    /* Add one sample. Safe to call from any thread */
+    void record(uint64_t value);
+
+    /* Value at given quantile, 0..1 */
+    uint64_t quantile(double q);
+
+    uint64_t getCount() { return count; }
+    uint64_t getSum() { return sum; }
+    uint64_t getMax() { return max; }
+};
+
+/* Frame metrics of a running widget, served as plain text on a local Unix socket */
+class Metrics {
+private:
+    /* Per-phase durations */
+    Histogram phases[FrameStats::PHASE_COUNT];
+
+    /* Listening socket and its path */
+    int listen_fd;
+    std::string path;
+
+public:
+    /* Frame counters */
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> overruns;
+    std::atomic<uint64_t> idle;
+    /* GL state changes issued to the driver and skipped by GLState */
+    std::atomic<uint64_t> gl_issued;
+    std::atomic<uint64_t> gl_elided;
+
+    /* Start listening on Unix socket at given path */
+    Metrics(const char* socket_path);
+    ~Metrics();
+
+    /* Add one phase duration */
+    void record(FrameStats::phase_t phase, uint64_t ns) { phases[phase].record(ns); }
+
+    /* Listening socket, to be watched by the main loop */
+    int getSocket() { return listen_fd; }
+    /* Accept waiting clients, send them all metrics and close the connections. Never blocks */
+    void serve();
+
+    /* All metrics as text */
+    std::string format();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pacer.h"
+
+#define NSEC_PER_SEC 1000000000ULL
+
+FramePacer::FramePacer() {
+    mode = PACE_FIXED;
+    period = 0;
+    deadline = 0;
+    missed = 0;
+}
+
+/* Current CLOCK_MONOTONIC time. Unlike gettimeofday() it never jumps on NTP adjustments */
+uint64_t FramePacer::now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Start pacing */
+void FramePacer::start(pacing_t pacing, int fps) {
+    mode = pacing;
+
+    /* Without valid FPS there's nothing to pace */
+    if( fps <= 0 && mode == PACE_FIXED ) mode = PACE_UNCAPPED;
+
+    period = fps > 0 ? NSEC_PER_SEC / fps : 0;
+    deadline = now();
+    missed = 0;
+}
+
+/* Schedule the next frame */
+void FramePacer::frameDone() {
+    if( mode != PACE_FIXED ) return;
+
+    /* Next deadline is always one period after the previous one, not after 'now' */
+    deadline += period;
+
+    /* Frame took too long and the deadline is already gone. Don't try to catch up
+       with a burst of frames - start a new grid from the current time */
+    uint64_t t = now();
+    if( t > deadline ) {
+        missed += 1;
+        deadline = t;
+    }
+}
+
+/* Loop has been idle for more than one frame (nothing to draw). Start a new frame grid
+   from the current time without counting the idle time as missed frames */
+void FramePacer::resume(uint64_t time) {
+    if( mode != PACE_FIXED ) return;
+
+    if( time >= deadline + period ) deadline = time;
+}
+
+/* Parse pacing mode name */
+FramePacer::pacing_t FramePacer::parse(const char* name, pacing_t fallback) {
+    if( strcmp(name, "fixed") == 0 ) return PACE_FIXED;
+    if( strcmp(name, "vsync") == 0 ) return PACE_VSYNC;
+    if( strcmp(name, "uncapped") == 0 ) return PACE_UNCAPPED;
+
+    fprintf(stderr, "Unknown pacing mode: %s\n", name);
+    return fallback;
+}
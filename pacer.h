@@ -0,0 +1,56 @@
+#ifndef __PACER_H__
+#define __PACER_H__
+
+#include <stdint.h>
+
+/* Frame pacer. Keeps the main loop on a grid of absolute CLOCK_MONOTONIC deadlines,
+   so sleep errors don't accumulate from frame to frame. The loop sleeps until getDeadline()
+   on its own timer */
+class FramePacer {
+public:
+    /* Pacing modes */
+    typedef enum {
+        /* Sleep until the next frame deadline, given FPS */
+        PACE_FIXED,
+        /* No sleeping, eglSwapBuffers() blocks on vertical sync */
+        PACE_VSYNC,
+        /* No sleeping at all, draw as fast as possible */
+        PACE_UNCAPPED
+    } pacing_t;
+
+private:
+    /* Current mode */
+    pacing_t mode;
+
+    /* One frame duration, nanoseconds */
+    uint64_t period;
+    /* Absolute start time of the next frame, nanoseconds */
+    uint64_t deadline;
+
+    /* Number of frames which missed their deadline */
+    uint64_t missed;
+
+public:
+    FramePacer();
+
+    /* Start pacing at given FPS. First frame is due immediately */
+    void start(pacing_t mode, int fps);
+
+    /* Called after the frame has been drawn: schedule the next one */
+    void frameDone();
+    /* Called when the frame starts after the loop has been idle */
+    void resume(uint64_t time);
+
+    /* Absolute time the next frame is due at */
+    uint64_t getDeadline() { return deadline; }
+    /* Number of frames which missed their deadline */
+    uint64_t getMissed() { return missed; }
+
+    /* Current CLOCK_MONOTONIC time in nanoseconds */
+    static uint64_t now();
+
+    /* Parse mode name: "fixed", "vsync" or "uncapped" */
+    static pacing_t parse(const char* name, pacing_t fallback);
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include "pixels.h"
+
+/* Vector code is on unless EGLWIDGET_SIMD=0 */
+static bool use_simd() {
+    static const bool enabled = getenv("EGLWIDGET_SIMD") == NULL || strcmp(getenv("EGLWIDGET_SIMD"), "0") != 0;
+    return enabled;
+}
+
+/* Ordered dithering thresholds, 0..15 */
+static const unsigned char bayer[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+/* Dithering offsets of four pixels of a row, RGBA each. Less than one step of the packed channel,
+   so they push a value to the next step as often as its dropped bits say */
+static void dither_offsets(size_t y, GLenum type, unsigned char offsets[16]) {
+    /* Step of R, G, B and A of the packed format, 0 if not dithered */
+    static const unsigned char steps_565[4] = { 8, 4, 8, 0 };
+    static const unsigned char steps_5551[4] = { 8, 8, 8, 0 };
+    static const unsigned char steps_4444[4] = { 16, 16, 16, 16 };
+    const unsigned char* steps = type == GL_UNSIGNED_SHORT_5_6_5 ? steps_565
+                               : type == GL_UNSIGNED_SHORT_5_5_5_1 ? steps_5551 : steps_4444;
+
+    for( int x = 0; x < 4; ++x )
+        for( int c = 0; c < 4; ++c )
+            offsets[x * 4 + c] = bayer[y & 3][x] * steps[c] / 16;
+}
+
+/* x / 255 rounded to nearest, exact for x up to 255 * 255 */
+static inline unsigned char div255(unsigned x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+/* Plain C versions, also finishing rows vector code leaves */
+
+static void premultiply_scalar(const unsigned char* rgba, unsigned char* out, size_t count) {
+    for( size_t i = 0; i < count; ++i, rgba += 4, out += 4 ) {
+        unsigned char a = rgba[3];
+        out[0] = div255(rgba[0] * a);
+        out[1] = div255(rgba[1] * a);
+        out[2] = div255(rgba[2] * a);
+        out[3] = a;
+    }
+}
+
+/* Pixel 'x' of a row gets offsets[(x & 3) * 4 + channel] added before packing */
+static void pack_scalar(const unsigned char* rgba, uint16_t* packed, size_t x, size_t count, GLenum type,
+                        const unsigned char offsets[16]) {
+    for( size_t i = 0; i < count; ++i, ++x, rgba += 4 ) {
+        const unsigned char* offset = &offsets[(x & 3) * 4];
+        unsigned char r = std::min(rgba[0] + offset[0], 255);
+        unsigned char g = std::min(rgba[1] + offset[1], 255);
+        unsigned char b = std::min(rgba[2] + offset[2], 255);
+        unsigned char a = std::min(rgba[3] + offset[3], 255);
+
+        switch( type ) {
+            case GL_UNSIGNED_SHORT_5_6_5:
+                packed[i] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+                break;
+            case GL_UNSIGNED_SHORT_5_5_5_1:
+                packed[i] = ((r >> 3) << 11) | ((g >> 3) << 6) | ((b >> 3) << 1) | (a >> 7);
+                break;
+            case GL_UNSIGNED_SHORT_4_4_4_4:
+                packed[i] = ((r >> 4) << 12) | ((g >> 4) << 8) | ((b >> 4) << 4) | (a >> 4);
+                break;
+        }
+    }
+}
+
+static void colorize_scalar(const unsigned char* coverage, unsigned char* rgba, size_t count, const unsigned char color[4]) {
+    for( size_t i = 0; i < count; ++i, rgba += 4 ) {
+        for( int c = 0; c < 4; ++c ) rgba[c] = div255(color[c] * coverage[i]);
+    }
+}
+
+#if defined(__SSE2__)
+
+/* Same rounding on 16-bit lanes */
+static inline __m128i div255_sse2(__m128i x) {
+    x = _mm_add_epi16(x, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+/* 4 pixels, RGBA in the low to high byte of each 32-bit lane, to packed ones in the low halves of the lanes */
+static inline __m128i pack4_sse2(__m128i p, GLenum type) {
+    switch( type ) {
+        case GL_UNSIGNED_SHORT_5_6_5:
+            return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8),
+                                             _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xFC00)), 5)),
+                                _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF80000)), 19));
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF8)), 8),
+                                             _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF800)), 5)),
+                                _mm_or_si128(_mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF80000)), 18),
+                                             _mm_srli_epi32(p, 31)));
+        default:
+            return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF0)), 8),
+                                             _mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF000)), 4)),
+                                _mm_or_si128(_mm_srli_epi32(_mm_and_si128(p, _mm_set1_epi32(0xF00000)), 16),
+                                             _mm_srli_epi32(p, 28)));
+    }
+}
+
+/* Narrow low halves of 32-bit lanes to 16 bits. packs saturates signed values, so sign-extend them first */
+static inline __m128i narrow_sse2(__m128i lo, __m128i hi) {
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(lo, 16), 16), _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16));
+}
+
+/* Returns number of pixels done, the rest is left to plain C */
+static size_t premultiply_simd(const unsigned char* rgba, unsigned char* out, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    /* Alpha is multiplied by 255 to stay as it is */
+    const __m128i color_mask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+    const __m128i alpha_one = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+
+    size_t i = 0;
+    for( ; i + 4 <= count; i += 4 ) {
+        __m128i p = _mm_loadu_si128((const __m128i*) (rgba + i * 4));
+        __m128i halves[2] = { _mm_unpacklo_epi8(p, zero), _mm_unpackhi_epi8(p, zero) };
+        for( int h = 0; h < 2; ++h ) {
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(halves[h], _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            alpha = _mm_or_si128(_mm_and_si128(alpha, color_mask), alpha_one);
+            halves[h] = div255_sse2(_mm_mullo_epi16(halves[h], alpha));
+        }
+        _mm_storeu_si128((__m128i*) (out + i * 4), _mm_packus_epi16(halves[0], halves[1]));
+    }
+    return i;
+}
+
+static size_t pack_simd(const unsigned char* rgba, uint16_t* packed, size_t count, GLenum type, const unsigned char offsets[16]) {
+    const __m128i offset = _mm_loadu_si128((const __m128i*) offsets);
+
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ) {
+        __m128i lo = _mm_adds_epu8(_mm_loadu_si128((const __m128i*) (rgba + i * 4)), offset);
+        __m128i hi = _mm_adds_epu8(_mm_loadu_si128((const __m128i*) (rgba + i * 4 + 16)), offset);
+        _mm_storeu_si128((__m128i*) (packed + i), narrow_sse2(pack4_sse2(lo, type), pack4_sse2(hi, type)));
+    }
+    return i;
+}
+
+static size_t colorize_simd(const unsigned char* coverage, unsigned char* rgba, size_t count, const unsigned char color[4]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color16 = _mm_set_epi16(color[3], color[2], color[1], color[0], color[3], color[2], color[1], color[0]);
+
+    size_t i = 0;
+    for( ; i + 16 <= count; i += 16 ) {
+        __m128i c = _mm_loadu_si128((const __m128i*) (coverage + i));
+        /* Every coverage byte repeated for 4 channels, 4 pixels per vector */
+        __m128i pairs[2] = { _mm_unpacklo_epi8(c, c), _mm_unpackhi_epi8(c, c) };
+        for( int q = 0; q < 4; ++q ) {
+            __m128i quad = (q & 1) ? _mm_unpackhi_epi16(pairs[q / 2], pairs[q / 2]) : _mm_unpacklo_epi16(pairs[q / 2], pairs[q / 2]);
+            __m128i lo = div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(quad, zero), color16));
+            __m128i hi = div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(quad, zero), color16));
+            _mm_storeu_si128((__m128i*) (rgba + (i + q * 4) * 4), _mm_packus_epi16(lo, hi));
+        }
+    }
+    return i;
+}
+
+#elif defined(PIXELS_NEON)
+
+/* Same rounding, narrowed to bytes: (x + ((x + 128) >> 8) + 128) >> 8 */
+static inline uint8x8_t div255_neon(uint16x8_t x) {
+    return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+}
+
+/* Channels of 8 pixels to packed ones: shift-right-and-insert each channel below the previous ones */
+static inline uint16x8_t pack8_neon(uint8x8x4_t p, GLenum type) {
+    uint16x8_t r = vshll_n_u8(p.val[0], 8);
+    uint16x8_t g = vshll_n_u8(p.val[1], 8);
+    uint16x8_t b = vshll_n_u8(p.val[2], 8);
+    uint16x8_t a = vshll_n_u8(p.val[3], 8);
+
+    switch( type ) {
+        case GL_UNSIGNED_SHORT_5_6_5:
+            return vsriq_n_u16(vsriq_n_u16(r, g, 5), b, 11);
+        case GL_UNSIGNED_SHORT_5_5_5_1:
+            return vsriq_n_u16(vsriq_n_u16(vsriq_n_u16(r, g, 5), b, 10), a, 15);
+        default:
+            return vsriq_n_u16(vsriq_n_u16(vsriq_n_u16(r, g, 4), b, 8), a, 12);
+    }
+}
+
+static size_t premultiply_simd(const unsigned char* rgba, unsigned char* out, size_t count) {
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ) {
+        uint8x8x4_t p = vld4_u8(rgba + i * 4);
+        for( int c = 0; c < 3; ++c ) p.val[c] = div255_neon(vmull_u8(p.val[c], p.val[3]));
+        vst4_u8(out + i * 4, p);
+    }
+    return i;
+}
+
+static size_t pack_simd(const unsigned char* rgba, uint16_t* packed, size_t count, GLenum type, const unsigned char offsets[16]) {
+    /* Offsets of 8 pixels split into channels the way vld4 splits pixels */
+    unsigned char repeated[32];
+    memcpy(repeated, offsets, 16);
+    memcpy(repeated + 16, offsets, 16);
+    uint8x8x4_t offset = vld4_u8(repeated);
+
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ) {
+        uint8x8x4_t p = vld4_u8(rgba + i * 4);
+        for( int c = 0; c < 4; ++c ) p.val[c] = vqadd_u8(p.val[c], offset.val[c]);
+        vst1q_u16(packed + i, pack8_neon(p, type));
+    }
+    return i;
+}
+
+static size_t colorize_simd(const unsigned char* coverage, unsigned char* rgba, size_t count, const unsigned char color[4]) {
+    size_t i = 0;
+    for( ; i + 8 <= count; i += 8 ) {
+        uint8x8_t c = vld1_u8(coverage + i);
+        uint8x8x4_t p;
+        for( int k = 0; k < 4; ++k ) p.val[k] = div255_neon(vmull_u8(c, vdup_n_u8(color[k])));
+        vst4_u8(rgba + i * 4, p);
+    }
+    return i;
+}
+
+#else
+
+static size_t premultiply_simd(const unsigned char*, unsigned char*, size_t) { return 0; }
+static size_t pack_simd(const unsigned char*, uint16_t*, size_t, GLenum, const unsigned char*) { return 0; }
+static size_t colorize_simd(const unsigned char*, unsigned char*, size_t, const unsigned char*) { return 0; }
+
+#endif
+
+/* Multiply colour of RGBA pixels by their alpha */
+void premultiply_pixels(const unsigned char* rgba, unsigned char* premultiplied, size_t count) {
+    size_t done = use_simd() ? premultiply_simd(rgba, premultiplied, count) : 0;
+    premultiply_scalar(rgba + done * 4, premultiplied + done * 4, count - done);
+}
+
+/* Convert RGBA pixels to 16-bit packed ones */
+void pack_pixels(const unsigned char* rgba, uint16_t* packed, size_t count, GLenum type) {
+    static const unsigned char none[16] = { 0 };
+    size_t done = use_simd() ? pack_simd(rgba, packed, count, type, none) : 0;
+    pack_scalar(rgba + done * 4, packed + done, done, count - done, type, none);
+}
+
+/* Convert a row of RGBA pixels to dithered 16-bit packed ones. Vector code starts at x = 0 and goes
+   8 pixels at a time, so the offsets line up with the pixels */
+void pack_pixels_dithered(const unsigned char* rgba, uint16_t* packed, size_t width, size_t y, GLenum type) {
+    unsigned char offsets[16];
+    dither_offsets(y, type, offsets);
+    size_t done = use_simd() ? pack_simd(rgba, packed, width, type, offsets) : 0;
+    pack_scalar(rgba + done * 4, packed + done, done, width - done, type, offsets);
+}
+
+/* Fill RGBA pixels with colour scaled by coverage */
+void colorize_coverage(const unsigned char* coverage, unsigned char* rgba, size_t count, const unsigned char color[4]) {
+    size_t done = use_simd() ? colorize_simd(coverage, rgba, count, color) : 0;
+    colorize_scalar(coverage + done, rgba + done * 4, count - done, color);
+}
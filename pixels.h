@@ -0,0 +1,29 @@
+#ifndef __PIXELS_H__
+#define __PIXELS_H__
+
+#include <GLES2/gl2.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pixel conversion done before texture uploads. Kernels use SSE2 on x86, NEON on ARM when it's enabled
+   at build time (make NEON=1 on 32-bit boards), plain C otherwise. All paths give the same results
+   to the bit, EGLWIDGET_SIMD=0 switches vector code off to compare.
+
+   RGBA pixels are 4 bytes in R, G, B, A order. Source and destination may be the same buffer */
+
+/* Multiply colour of RGBA pixels by their alpha, rounding to nearest */
+void premultiply_pixels(const unsigned char* rgba, unsigned char* premultiplied, size_t count);
+
+/* Convert RGBA pixels to 16-bit packed ones of GL_UNSIGNED_SHORT_5_6_5, GL_UNSIGNED_SHORT_5_5_5_1 or
+   GL_UNSIGNED_SHORT_4_4_4_4 type, dropping low bits */
+void pack_pixels(const unsigned char* rgba, uint16_t* packed, size_t count, GLenum type);
+
+/* Same for row 'y' of an image, with 4x4 ordered dithering instead of dropping low bits, so smooth gradients
+   don't band. Alpha of RGBA5551 isn't dithered */
+void pack_pixels_dithered(const unsigned char* rgba, uint16_t* packed, size_t width, size_t y, GLenum type);
+
+/* Fill RGBA pixels with premultiplied colour scaled by coverage, 0..255 each, e.g. of a FreeType glyph */
+void colorize_coverage(const unsigned char* coverage, unsigned char* rgba, size_t count, const unsigned char color[4]);
+
+#endif
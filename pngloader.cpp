@@ -1,17 +1,42 @@
 #include <math.h>
 #include <png.h>
 #include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <setjmp.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include "pngloader.h"
+#include "pixels.h"
+
+/* Rows decoded at once when streaming. Peak memory is one strip instead of the whole image */
+static const png_uint_32 STRIP_ROWS = 16;
+
+const texture_options_t default_texture_options = { false, false, true };
+
+/* Transparency of the source image, decides on the packed texture format */
+typedef enum {
+    ALPHA_NONE,
+    ALPHA_BINARY,
+    ALPHA_GRADED
+} alpha_usage_t;
 
-/* Decoded image */
+/* Texture upload format */
 typedef struct {
-    const png_uint_32 width;
-    const png_uint_32 height;
-    const png_size_t size;
-    const GLenum gl_color_format;
-    const void* data;
-} RawImageData;
+    GLenum format;
+    GLenum type;
+    /* Bytes per pixel */
+    int size;
+} gl_pixel_format_t;
 
 typedef struct {
     const png_byte* data;
@@ -24,27 +49,49 @@ typedef struct {
 } ReadDataHandle;
 
 typedef struct {
-    const png_uint_32 width;
-    const png_uint_32 height;
-    const int color_type;
+    png_uint_32 width;
+    png_uint_32 height;
+    int color_type;
+    /* Bytes per decoded row */
+    png_size_t row_size;
+    /* Interlaced images are decoded in several passes */
+    int passes;
+    alpha_usage_t alpha;
 } PngInfo;
 
-/* Copy one row of image into pixel buffer */
+/* Feed libpng straight from the file mapping */
 static void read_png_data_callback(png_structp png_ptr, png_byte* raw_data, png_size_t read_length) {
     ReadDataHandle* handle = (ReadDataHandle *) png_get_io_ptr(png_ptr);
-    const png_byte* png_src = handle->data.data + handle->offset;
+    if( read_length > handle->data.size - handle->offset ) png_error(png_ptr, "Unexpected end of PNG data");
 
-    memcpy(raw_data, png_src, read_length);
+    memcpy(raw_data, handle->data.data + handle->offset, read_length);
     handle->offset += read_length;
 }
 
-static PngInfo read_and_update_info(const png_structp png_ptr, const png_infop info_ptr) {
+/* Set up transformations into 8-bit pixels. RGBA output is forced if 'rgba' is set,
+   otherwise greyscale images stay greyscale */
+static PngInfo read_and_update_info(const png_structp png_ptr, const png_infop info_ptr, bool rgba) {
     png_uint_32 width, height;
     int bit_depth, color_type;
 
     png_read_info(png_ptr, info_ptr);
     png_get_IHDR(png_ptr, info_ptr, &width, &height, &bit_depth, &color_type, NULL, NULL, NULL);
 
+    /* Colour key and palette transparency are mostly on/off, alpha channel isn't */
+    alpha_usage_t alpha = ALPHA_NONE;
+    if (color_type & PNG_COLOR_MASK_ALPHA)
+        alpha = ALPHA_GRADED;
+    else if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+        alpha = ALPHA_BINARY;
+
+        png_bytep trans = NULL;
+        int num_trans = 0;
+        if (color_type == PNG_COLOR_TYPE_PALETTE && png_get_tRNS(png_ptr, info_ptr, &trans, &num_trans, NULL)) {
+            for (int i = 0; i < num_trans; ++i)
+                if (trans[i] != 0 && trans[i] != 0xFF) alpha = ALPHA_GRADED;
+        }
+    }
+
     /* Transparency -> alpha channel */
     if (png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS))
         png_set_tRNS_to_alpha(png_ptr);
@@ -53,59 +100,30 @@ static PngInfo read_and_update_info(const png_structp png_ptr, const png_infop i
     if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
         png_set_expand_gray_1_2_4_to_8(png_ptr);
 
+    if (rgba && (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA))
+        png_set_gray_to_rgb(png_ptr);
+
     /* Handle paletted image */
     if (color_type == PNG_COLOR_TYPE_PALETTE)
         png_set_palette_to_rgb(png_ptr);
 
     /* Make sure we have alpha channel */
-    if (color_type == PNG_COLOR_TYPE_PALETTE || color_type == PNG_COLOR_TYPE_RGB)
+    if (color_type == PNG_COLOR_TYPE_PALETTE || color_type == PNG_COLOR_TYPE_RGB || (rgba && color_type == PNG_COLOR_TYPE_GRAY))
         png_set_add_alpha(png_ptr, 0xFF, PNG_FILLER_AFTER);
 
     /* Make sure we work with 8-bit images */
     if (bit_depth < 8)
         png_set_packing(png_ptr);
-    else if (bit_depth == 16) {
-        printf("16 bit image not supported\n");
-        assert(0);
-    }
+    else if (bit_depth == 16)
+        png_set_strip_16(png_ptr);
 
+    int passes = png_set_interlace_handling(png_ptr);
     png_read_update_info(png_ptr, info_ptr);
 
     /* Get color type */
     color_type = png_get_color_type(png_ptr, info_ptr);
 
-    return (PngInfo) {width, height, color_type};
-}
-
-/* Decode PNG-data */
-static DataHandle read_entire_png_image(
-        const png_structp png_ptr,
-        const png_infop info_ptr,
-        const png_uint_32 height)
-{
-    /* How many bytes per image row */
-    const png_size_t row_size = png_get_rowbytes(png_ptr, info_ptr);
-    /* How many byte per image */
-    const png_size_t data_length = row_size * height;
-    assert(row_size > 0);
-
-    /* Image buffer */
-    png_byte* raw_image = (png_byte *) malloc(data_length);
-    assert(raw_image != NULL);
-
-    /* Pointers to image rows */
-    png_byte* row_ptrs[height];
-
-    /* Initialize pointers */
-    png_uint_32 i;
-    for (i = 0; i < height; i++) {
-        row_ptrs[i] = raw_image + i * row_size;
-    }
-
-    /*  Decode file */
-    png_read_image(png_ptr, &row_ptrs[0]);
-
-    return (DataHandle) {raw_image, data_length};
+    return (PngInfo) {width, height, color_type, png_get_rowbytes(png_ptr, info_ptr), passes, alpha};
 }
 
 /* Transform PNG color type into EGL texture format */
@@ -126,54 +144,207 @@ static GLenum get_gl_color_format(const int png_color_format) {
     return 0;
 }
 
-/* Free resources */
-static void release_raw_image_data(const RawImageData* img) {
-    assert(img != NULL);
-    free((void*)img->data);
+/* Choose texture format for decoded pixels of given PNG color type */
+static gl_pixel_format_t get_gl_pixel_format(const int png_color_format, alpha_usage_t alpha, const texture_options_t& options) {
+    GLenum format = get_gl_color_format(png_color_format);
+    if (format == GL_LUMINANCE) return (gl_pixel_format_t) {format, GL_UNSIGNED_BYTE, 1};
+    if (format == GL_LUMINANCE_ALPHA) return (gl_pixel_format_t) {format, GL_UNSIGNED_BYTE, 2};
+    if (!options.packed) return (gl_pixel_format_t) {GL_RGBA, GL_UNSIGNED_BYTE, 4};
+
+    switch (alpha) {
+        case ALPHA_NONE:
+            return (gl_pixel_format_t) {GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 2};
+        case ALPHA_BINARY:
+            return (gl_pixel_format_t) {GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, 2};
+        default:
+            return (gl_pixel_format_t) {GL_RGBA, GL_UNSIGNED_SHORT_4_4_4_4, 2};
+    }
 }
 
-/* Decode PNG-file to pixels */
-static RawImageData get_raw_image_data_from_png(const void* png_data, const png_size_t png_data_size) {
-    /* Make sure it's PNG */
-    assert(png_data != NULL && png_data_size > 8);
-    assert(png_check_sig((png_bytep)png_data, 8));
+/* Find out how RGBA pixels use transparency */
+static alpha_usage_t get_alpha_usage(const png_byte* pixels, size_t count) {
+    alpha_usage_t alpha = ALPHA_NONE;
+    for (size_t i = 0; i < count; ++i) {
+        png_byte a = pixels[i * 4 + 3];
+        if (a == 0) alpha = ALPHA_BINARY;
+        else if (a != 0xFF) return ALPHA_GRADED;
+    }
+    return alpha;
+}
+
+/* Convert rows of RGBA pixels, the first one being row 'y' of the image, to 16-bit packed ones of given type */
+static void pack_rows(const png_byte* rgba, uint16_t* packed, size_t width, size_t y, size_t rows, GLenum type, bool dithered) {
+    if( ! dithered ) {
+        pack_pixels(rgba, packed, width * rows, type);
+        return;
+    }
+    for( size_t row = 0; row < rows; ++row )
+        pack_pixels_dithered(rgba + row * width * 4, packed + row * width, width, y + row, type);
+}
+
+/* PNG file decoded straight from its memory mapping, without reading it into a buffer */
+class PngFile {
+private:
+    std::string path;
+    void* map;
+    size_t map_size;
+
+    png_structp png_ptr;
+    png_infop info_ptr;
+    ReadDataHandle* handle;
 
-    /* Prepare for decoding */
-    png_structp png_ptr = png_create_read_struct(
-            PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-    assert(png_ptr != NULL);
+    void fail() {
+        throw std::runtime_error("Cannot decode PNG file: " + path);
+    }
+
+public:
+    PngInfo info;
+
+    /* Map the file and read its header */
+    PngFile(const char* file, bool rgba): path(file) {
+        map = MAP_FAILED;
+        map_size = 0;
+        png_ptr = NULL;
+        info_ptr = NULL;
+        handle = NULL;
+
+        int fd = open(file, O_RDONLY | O_CLOEXEC);
+        if( fd < 0 ) throw std::runtime_error(std::string("Cannot open file: ") + file);
+
+        /* Shorter than PNG signature */
+        struct stat st;
+        if( fstat(fd, &st) != 0 || st.st_size <= 8 ) {
+            close(fd);
+            throw std::runtime_error(std::string("Not a PNG file: ") + file);
+        }
+
+        map_size = st.st_size;
+        map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if( map == MAP_FAILED ) throw std::runtime_error(std::string("Cannot map file: ") + file);
+
+        /* Data is read once from start to end */
+        madvise(map, map_size, MADV_SEQUENTIAL);
+
+        /* Make sure it's PNG */
+        if( png_sig_cmp((png_const_bytep) map, 0, 8) != 0 ) {
+            release();
+            throw std::runtime_error(std::string("Not a PNG file: ") + file);
+        }
+
+        /* Prepare for decoding */
+        png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+        if( png_ptr != NULL ) info_ptr = png_create_info_struct(png_ptr);
+        if( info_ptr == NULL ) {
+            release();
+            throw std::runtime_error("Cannot create PNG decoder");
+        }
+
+        /* Set our callback */
+        handle = new ReadDataHandle {{(const png_byte *) map, map_size}, 0};
+        png_set_read_fn(png_ptr, handle, read_png_data_callback);
+
+        /* libpng reports errors with longjmp() */
+        if( setjmp(png_jmpbuf(png_ptr)) ) {
+            release();
+            fail();
+        }
+        info = read_and_update_info(png_ptr, info_ptr, rgba);
+    }
 
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    assert(info_ptr != NULL);
+    ~PngFile() {
+        release();
+    }
 
-    /* Set our callback */
-    ReadDataHandle png_data_handle = (ReadDataHandle) {{(const png_byte *) png_data, png_data_size}, 0};
-    png_set_read_fn(png_ptr, &png_data_handle, read_png_data_callback);
+    void release() {
+        if( png_ptr != NULL ) png_destroy_read_struct(&png_ptr, info_ptr != NULL ? &info_ptr : NULL, NULL);
+        png_ptr = NULL;
+        info_ptr = NULL;
 
-    /* Set error handler */
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        printf("Error reading PNG file");
-        assert(0);
+        delete handle;
+        handle = NULL;
+
+        if( map != MAP_FAILED ) munmap(map, map_size);
+        map = MAP_FAILED;
     }
 
-    /* Process data */
-    const PngInfo png_info = read_and_update_info(png_ptr, info_ptr);
-    const DataHandle raw_image = read_entire_png_image(png_ptr, info_ptr, png_info.height);
+    /* Decode the whole image into caller's buffer, rows 'stride' bytes apart */
+    void decode(png_byte* pixels, size_t stride) {
+        if( setjmp(png_jmpbuf(png_ptr)) ) fail();
 
-    png_read_end(png_ptr, info_ptr);
-    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        for( int pass = 0; pass < info.passes; ++pass ) {
+            for( png_uint_32 row = 0; row < info.height; ++row )
+                png_read_row(png_ptr, pixels + row * stride, NULL);
+        }
+        png_read_end(png_ptr, NULL);
+    }
 
-    /* Result */
-    return (RawImageData) {
-            png_info.width,
-            png_info.height,
-            raw_image.size,
-            get_gl_color_format(png_info.color_type),
-            raw_image.data};
+    /* Decode non-interlaced image in strips of rows, which are passed to 'strip' one after another.
+       'strip' may throw, it's called outside of libpng */
+    template <typename F>
+    void decodeStrips(png_byte* buffer, F strip) {
+        for( png_uint_32 first = 0; first < info.height; first += STRIP_ROWS ) {
+            png_uint_32 count = std::min(STRIP_ROWS, info.height - first);
+            if( ! readRows(buffer, count) ) fail();
+            strip(buffer, first, count);
+        }
+
+        if( setjmp(png_jmpbuf(png_ptr)) ) fail();
+        png_read_end(png_ptr, NULL);
+    }
+
+    /* Decode next 'count' rows, false on error */
+    bool readRows(png_byte* buffer, png_uint_32 count) {
+        if( setjmp(png_jmpbuf(png_ptr)) ) return false;
+
+        for( png_uint_32 row = 0; row < count; ++row )
+            png_read_row(png_ptr, buffer + row * info.row_size, NULL);
+        return true;
+    }
+};
+
+static bool is_power_of_two(size_t n) {
+    return n != 0 && (n & (n - 1)) == 0;
+}
+
+/* Can the texture of given size have mipmaps */
+static bool can_mipmap(size_t width, size_t height) {
+    static int npot = -1;
+    if( npot < 0 ) {
+        const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+        npot = extensions != NULL && strstr(extensions, "GL_OES_texture_npot") != NULL;
+    }
+    return npot || (is_power_of_two(width) && is_power_of_two(height));
+}
+
+/* Set texture parameters of the bound texture. Returns whether mipmaps have to be generated after upload */
+static bool gl_texture_parameters(size_t width, size_t height, const texture_options_t& options) {
+    /* GLES2 can repeat only power of two textures */
+    GLenum wrap = is_power_of_two(width) && is_power_of_two(height) ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+    bool mipmaps = options.mipmaps && can_mipmap(width, height);
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    return mipmaps;
+}
+
+/* GPU memory taken by a texture, the mip chain included */
+static size_t texture_bytes(size_t width, size_t height, const gl_pixel_format_t& format, bool mipmaps) {
+    size_t bytes = width * height * format.size;
+    while( mipmaps && (width > 1 || height > 1) ) {
+        width = std::max(width / 2, (size_t) 1);
+        height = std::max(height / 2, (size_t) 1);
+        bytes += width * height * format.size;
+    }
+    return bytes;
 }
 
-/* Create an EGL texture based on a pixel buffer */
-static GLuint gl_load_texture(const GLsizei width, const GLsizei height, const GLenum type, const GLvoid* pixels) {
+/* Create an EGL texture based on a pixel buffer of given format */
+static GLuint gl_load_texture(const GLsizei width, const GLsizei height, const gl_pixel_format_t& format, const GLvoid* pixels,
+                              const texture_options_t& options, size_t* bytes) {
     GLuint texture_id = 0;
 
     /* Create texture */
@@ -182,84 +353,172 @@ static GLuint gl_load_texture(const GLsizei width, const GLsizei height, const G
 
     /* Initialize texture parameters */
     glBindTexture(GL_TEXTURE_2D, texture_id);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    bool mipmaps = gl_texture_parameters(width, height, options);
 
-    /* Load pixels into texture */
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    /* Load pixels into texture, smaller levels are made out of it */
+    glTexImage2D(GL_TEXTURE_2D, 0, format.format, width, height, 0, format.format, format.type, pixels);
+    if( mipmaps ) glGenerateMipmap(GL_TEXTURE_2D);
+    if( bytes != NULL ) *bytes = texture_bytes(width, height, format, mipmaps);
 
     /* Return texture descriptor */
     return texture_id;
 }
 
-/* Load file into memory */
-static png_bytep load_file(const char* path, size_t* data_length) {
-    /* Open file, get it's size */
-    FILE* fp = fopen(path, "r");
-    assert( fp != NULL );
-    assert( fseek(fp, 0, SEEK_END) != -1 );
+/* Load and decode a PNG-file into RGBA pixels, or greyscale ones unless 'rgba' is set */
+static char* decode_png_image(const char* path, bool rgba, size_t* width, size_t* height, GLenum* format) {
+    PngFile png(path, rgba);
 
-    size_t file_len = ftell(fp);
-    assert( fseek(fp, 0, SEEK_SET) != -1 );
+    /* The only copy of the image is the decoded one */
+    png_byte* pixels = (png_byte*) malloc(png.info.row_size * png.info.height);
+    if( pixels == NULL ) throw std::runtime_error(std::string("Not enough memory for image: ") + path);
 
-    /* Load into memory */
-    png_bytep data = (png_bytep) malloc(file_len);
-    assert( data != NULL );
-    assert( fread(data, 1, file_len, fp) == file_len );
-    fclose(fp);
+    try {
+        png.decode(pixels, png.info.row_size);
+    } catch( ... ) {
+        free(pixels);
+        throw;
+    }
 
-    if( data_length != NULL ) *data_length = file_len;
+    /* Get image size */
+    if( width != NULL )  *width = png.info.width;
+    if( height != NULL ) *height = png.info.height;
+    if( format != NULL ) *format = get_gl_color_format(png.info.color_type);
 
-    return data;
+    /* Return image data */
+    return (char*) pixels;
 }
 
 /* Load and decode a PNG-file */
 char* load_png_image(const char* path, size_t* width, size_t* height) {
-    /* Load file into memory */
-    size_t data_length = 0;
-    png_bytep data = load_file(path, &data_length);
+    return decode_png_image(path, true, width, height, NULL);
+}
 
-    /* Decode PNG-data into pixels */
-    const RawImageData raw_image_data = get_raw_image_data_from_png(data, data_length);
+/* Load and decode a PNG-file keeping its channels */
+char* load_png_image(const char* path, size_t* width, size_t* height, GLenum* format) {
+    return decode_png_image(path, false, width, height, format);
+}
 
-    /* Get image size */
-    if( width != NULL )  *width = raw_image_data.width;
-    if( height != NULL ) *height = raw_image_data.height;
+/* Get size of a PNG-file reading just its header */
+void read_png_size(const char* path, size_t* width, size_t* height) {
+    PngFile png(path, true);
 
-    /* Free memory */
-    free(data);
+    if( width != NULL )  *width = png.info.width;
+    if( height != NULL ) *height = png.info.height;
+}
 
-    /* Return image data */
-    return (char*) raw_image_data.data;
+/* Decode a PNG-file into caller's RGBA buffer */
+void load_png_image(const char* path, char* pixels, size_t width, size_t height, size_t stride) {
+    PngFile png(path, true);
+    if( png.info.width != width || png.info.height != height )
+        throw std::runtime_error(std::string("Unexpected image size: ") + path);
+
+    png.decode((png_byte*) pixels, stride);
+}
+
+/* Create EGL texture out of RGBA pixels */
+GLuint create_texture(const char* pixels, size_t width, size_t height) {
+    return create_texture(pixels, width, height, default_texture_options);
+}
+
+/* Create EGL texture out of RGBA pixels with given storage options */
+GLuint create_texture(const char* pixels, size_t width, size_t height, const texture_options_t& options) {
+    return create_texture(pixels, width, height, GL_RGBA, options, NULL);
+}
+
+/* Create EGL texture out of pixels of given format, packing RGBA ones if asked to */
+GLuint create_texture(const char* pixels, size_t width, size_t height, GLenum pixel_format, const texture_options_t& options,
+                      size_t* bytes) {
+    const png_byte* rgba = (const png_byte*) pixels;
+    size_t count = width * height;
+
+    int color_type = pixel_format == GL_LUMINANCE ? PNG_COLOR_TYPE_GRAY
+                   : pixel_format == GL_LUMINANCE_ALPHA ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_RGB_ALPHA;
+    alpha_usage_t alpha = options.packed && color_type == PNG_COLOR_TYPE_RGB_ALPHA ? get_alpha_usage(rgba, count) : ALPHA_GRADED;
+    gl_pixel_format_t format = get_gl_pixel_format(color_type, alpha, options);
+    if( format.type == GL_UNSIGNED_BYTE ) return gl_load_texture(width, height, format, pixels, options, bytes);
+
+    uint16_t* packed = (uint16_t*) malloc(count * sizeof(uint16_t));
+    if( packed == NULL ) throw std::runtime_error("Not enough memory for texture");
+    pack_rows(rgba, packed, width, 0, height, format.type, options.dithered);
+
+    GLuint texture_id = gl_load_texture(width, height, format, packed, options, bytes);
+    free(packed);
+    return texture_id;
 }
 
 /* Create EGL texture out of PNG-file, get image size */
 GLuint load_png_as_texture(const char* path, size_t* width, size_t* height) {
-    /* Load file into memory */
-    size_t data_length = 0;
-    png_bytep data = load_file(path, &data_length);
+    return load_png_as_texture(path, default_texture_options, width, height, NULL);
+}
+
+/* Create EGL texture out of PNG-file, get image size. Rows are uploaded in strips as they get decoded,
+   packed ones get converted strip by strip as well */
+GLuint load_png_as_texture(const char* path, const texture_options_t& options, size_t* width, size_t* height, size_t* bytes) {
+    PngFile png(path, false);
+    const PngInfo& info = png.info;
+    bool packed = options.packed && info.color_type == PNG_COLOR_TYPE_RGB_ALPHA;
+
+    /* Header tells only whether the image may be transparent. Packed format of such image depends on
+       the alpha its pixels actually use, so it is decoded whole and scanned like create_texture() does:
+       both pick the same format. Interlaced image is complete only after the last pass anyway */
+    bool whole = info.passes > 1 || (packed && info.alpha != ALPHA_NONE);
+    gl_pixel_format_t format = get_gl_pixel_format(info.color_type, info.alpha, options);
+
+    png_uint_32 buffer_rows = whole ? info.height : STRIP_ROWS;
+    png_byte* buffer = (png_byte*) malloc(info.row_size * buffer_rows);
+    uint16_t* packed_buffer = packed ? (uint16_t*) malloc(info.width * buffer_rows * sizeof(uint16_t)) : NULL;
+    if( buffer == NULL || (packed && packed_buffer == NULL) ) {
+        free(buffer);
+        free(packed_buffer);
+        throw std::runtime_error(std::string("Not enough memory for image: ") + path);
+    }
 
-    /* Decode file into pixels */
-    const RawImageData raw_image_data = get_raw_image_data_from_png(data, data_length);
+    /* Decoded rows in texture format */
+    auto convert = [&](const png_byte* rows, png_uint_32 first, png_uint_32 count) -> const GLvoid* {
+        if( ! packed ) return rows;
+        pack_rows(rows, packed_buffer, info.width, first, count, format.type, options.dithered);
+        return packed_buffer;
+    };
 
-    /* Convert pixels into texture */
-    const GLuint texture_object_id = gl_load_texture(
-            raw_image_data.width, raw_image_data.height,
-            raw_image_data.gl_color_format, raw_image_data.data);
+    GLuint texture_id = 0;
+    glGenTextures(1, &texture_id);
+    assert(texture_id != 0);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    bool mipmaps = gl_texture_parameters(info.width, info.height, options);
+
+    try {
+        if( whole ) {
+            png.decode(buffer, info.row_size);
+            if( packed && info.alpha != ALPHA_NONE )
+                format = get_gl_pixel_format(info.color_type, get_alpha_usage(buffer, info.width * info.height), options);
+            glTexImage2D(GL_TEXTURE_2D, 0, format.format, info.width, info.height, 0, format.format, format.type,
+                         convert(buffer, 0, info.height));
+        }
+        else {
+            /* Allocate texture storage, then fill it strip by strip */
+            glTexImage2D(GL_TEXTURE_2D, 0, format.format, info.width, info.height, 0, format.format, format.type, NULL);
+            png.decodeStrips(buffer, [&](const png_byte* rows, png_uint_32 first, png_uint_32 count) {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, info.width, count, format.format, format.type, convert(rows, first, count));
+            });
+        }
+    } catch( ... ) {
+        free(buffer);
+        free(packed_buffer);
+        glDeleteTextures(1, &texture_id);
+        throw;
+    }
+    free(buffer);
+    free(packed_buffer);
 
-    if( width != NULL ) *width = raw_image_data.width;
-    if( height != NULL ) *height = raw_image_data.height;
+    /* Whole image is there, build smaller levels out of it */
+    if( mipmaps ) glGenerateMipmap(GL_TEXTURE_2D);
+    if( bytes != NULL ) *bytes = texture_bytes(info.width, info.height, format, mipmaps);
 
-    /* Free resources */
-    release_raw_image_data(&raw_image_data);
-    free(data);
+    if( width != NULL ) *width = info.width;
+    if( height != NULL ) *height = info.height;
 
     /* Return texture descriptor */
-    return texture_object_id;
+    return texture_id;
 }
 
 /* Create EGL texture out of PNG file */
@@ -267,3 +526,216 @@ GLuint load_png_as_texture(const char* path) {
     return load_png_as_texture(path, NULL, NULL);
 }
 
+/* Number of channels of decoded pixels */
+static size_t channel_count(GLenum format) {
+    return format == GL_LUMINANCE ? 1 : (format == GL_LUMINANCE_ALPHA ? 2 : 4);
+}
+
+/* Average 2x2 pixels, odd last row and column are averaged with themselves */
+void halve_image(const char* pixels, size_t width, size_t height, GLenum format, char* half) {
+    const png_byte* src = (const png_byte*) pixels;
+    png_byte* dst = (png_byte*) half;
+    size_t channels = channel_count(format);
+    size_t half_width = std::max(width / 2, (size_t) 1);
+    size_t half_height = std::max(height / 2, (size_t) 1);
+
+    for( size_t y = 0; y < half_height; ++y ) {
+        const png_byte* row0 = src + std::min(y * 2, height - 1) * width * channels;
+        const png_byte* row1 = src + std::min(y * 2 + 1, height - 1) * width * channels;
+
+        for( size_t x = 0; x < half_width; ++x ) {
+            size_t x0 = std::min(x * 2, width - 1) * channels;
+            size_t x1 = std::min(x * 2 + 1, width - 1) * channels;
+
+            for( size_t c = 0; c < channels; ++c )
+                *dst++ = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+        }
+    }
+}
+
+/* Raw texture file header, in native byte order. Levels follow it, each one 16-byte aligned,
+   rows tightly packed */
+static const uint32_t RAW_TEXTURE_VERSION = 1;
+static const uint32_t RAW_TEXTURE_BYTE_ORDER = 0x01020304;
+static const uint32_t RAW_TEXTURE_MAX_LEVELS = 16;
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    /* RAW_TEXTURE_BYTE_ORDER as the baking machine stores it */
+    uint32_t byte_order;
+    uint32_t width;
+    uint32_t height;
+    /* glTexImage2D() format and type */
+    uint32_t format;
+    uint32_t type;
+    /* RAW_TEXTURE_* flags */
+    uint32_t flags;
+    uint32_t levels;
+    /* Level offsets from the start of the file */
+    uint32_t offsets[RAW_TEXTURE_MAX_LEVELS];
+} raw_texture_header_t;
+
+/* Bytes per pixel of given upload format, 0 if it's not one we store */
+static size_t raw_pixel_size(uint32_t format, uint32_t type) {
+    if( type == GL_UNSIGNED_BYTE ) {
+        if( format == GL_LUMINANCE ) return 1;
+        if( format == GL_LUMINANCE_ALPHA ) return 2;
+        if( format == GL_RGBA ) return 4;
+    }
+    if( format == GL_RGB && type == GL_UNSIGNED_SHORT_5_6_5 ) return 2;
+    if( format == GL_RGBA && (type == GL_UNSIGNED_SHORT_4_4_4_4 || type == GL_UNSIGNED_SHORT_5_5_5_1) ) return 2;
+    return 0;
+}
+
+/* Decode PNG-file, compute mipmaps and store levels in upload format */
+size_t bake_raw_texture(const char* png_path, const char* path, const texture_options_t& options, bool premultiply) {
+    size_t width, height;
+    GLenum format;
+    char* decoded = load_png_image(png_path, &width, &height, &format);
+    size_t channels = channel_count(format);
+    std::vector<png_byte> pixels((png_byte*) decoded, (png_byte*) decoded + width * height * channels);
+    free(decoded);
+
+    /* Premultiplied alpha has to be filtered into mipmaps already premultiplied */
+    bool premultiplied = premultiply && channels != 1;
+    if( premultiplied && channels == 4 )
+        premultiply_pixels(pixels.data(), pixels.data(), width * height);
+    else if( premultiplied ) {
+        /* Luminance and alpha */
+        for( size_t i = 0; i < width * height; ++i ) pixels[i * 2] = (pixels[i * 2] * pixels[i * 2 + 1] + 127) / 255;
+    }
+
+    int color_type = channels == 1 ? PNG_COLOR_TYPE_GRAY : (channels == 2 ? PNG_COLOR_TYPE_GRAY_ALPHA : PNG_COLOR_TYPE_RGB_ALPHA);
+    alpha_usage_t alpha = options.packed && channels == 4 ? get_alpha_usage(pixels.data(), width * height) : ALPHA_GRADED;
+    gl_pixel_format_t pixel_format = get_gl_pixel_format(color_type, alpha, options);
+
+    raw_texture_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "EGLT", 4);
+    header.version = RAW_TEXTURE_VERSION;
+    header.byte_order = RAW_TEXTURE_BYTE_ORDER;
+    header.width = width;
+    header.height = height;
+    header.format = pixel_format.format;
+    header.type = pixel_format.type;
+    header.flags = premultiplied ? RAW_TEXTURE_PREMULTIPLIED : 0;
+
+    std::vector<png_byte> file(sizeof(header));
+    size_t data_size = 0;
+    for( size_t w = width, h = height; ; ) {
+        file.resize((file.size() + 15) & ~(size_t) 15);
+        header.offsets[header.levels++] = file.size();
+
+        if( pixel_format.type == GL_UNSIGNED_BYTE )
+            file.insert(file.end(), pixels.begin(), pixels.end());
+        else {
+            std::vector<uint16_t> packed(w * h);
+            pack_rows(pixels.data(), packed.data(), w, 0, h, pixel_format.type, options.dithered);
+            file.insert(file.end(), (png_byte*) packed.data(), (png_byte*) (packed.data() + packed.size()));
+        }
+        data_size += w * h * pixel_format.size;
+
+        if( ! options.mipmaps || (w == 1 && h == 1) || header.levels == RAW_TEXTURE_MAX_LEVELS ) break;
+
+        std::vector<png_byte> half(std::max(w / 2, (size_t) 1) * std::max(h / 2, (size_t) 1) * channels);
+        halve_image((const char*) pixels.data(), w, h, format, (char*) half.data());
+        pixels.swap(half);
+        w = std::max(w / 2, (size_t) 1);
+        h = std::max(h / 2, (size_t) 1);
+    }
+    memcpy(file.data(), &header, sizeof(header));
+
+    FILE* out = fopen(path, "wb");
+    if( out == NULL ) throw std::runtime_error(std::string("Cannot create file: ") + path);
+    bool written = fwrite(file.data(), 1, file.size(), out) == file.size();
+    if( fclose(out) != 0 || ! written ) throw std::runtime_error(std::string("Cannot write file: ") + path);
+
+    return data_size;
+}
+
+/* Check header and level bounds of a mapped raw texture */
+static const raw_texture_header_t* check_raw_texture(const char* path, const png_byte* file, size_t size) {
+    const raw_texture_header_t* header = (const raw_texture_header_t*) file;
+    if( size < sizeof(raw_texture_header_t) || memcmp(header->magic, "EGLT", 4) != 0 )
+        throw std::runtime_error(std::string("Not a raw texture file: ") + path);
+    if( header->version != RAW_TEXTURE_VERSION || header->byte_order != RAW_TEXTURE_BYTE_ORDER )
+        throw std::runtime_error(std::string("Unsupported raw texture file: ") + path);
+
+    size_t pixel_size = raw_pixel_size(header->format, header->type);
+    if( pixel_size == 0 || header->width == 0 || header->height == 0
+        || header->levels == 0 || header->levels > RAW_TEXTURE_MAX_LEVELS )
+        throw std::runtime_error(std::string("Unsupported raw texture file: ") + path);
+
+    for( uint32_t i = 0; i < header->levels; ++i ) {
+        size_t w = std::max(header->width >> i, (uint32_t) 1);
+        size_t h = std::max(header->height >> i, (uint32_t) 1);
+        /* Sizes come from the file: divide instead of multiplying, w * h * pixel_size may wrap size_t */
+        if( header->offsets[i] > size || h > (size - header->offsets[i]) / pixel_size / w )
+            throw std::runtime_error(std::string("Truncated raw texture file: ") + path);
+    }
+
+    return header;
+}
+
+/* Upload levels straight from the file mapping */
+GLuint load_raw_texture(const char* path, const texture_options_t& options, size_t* width, size_t* height, size_t* bytes,
+                        unsigned* flags) {
+    int fd = open(path, O_RDONLY);
+    if( fd < 0 ) throw std::runtime_error(std::string("Cannot open file: ") + path);
+
+    struct stat st;
+    if( fstat(fd, &st) != 0 ) {
+        close(fd);
+        throw std::runtime_error(std::string("Cannot read file: ") + path);
+    }
+
+    size_t size = st.st_size;
+    void* map = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if( map == MAP_FAILED ) throw std::runtime_error(std::string("Not a raw texture file: ") + path);
+    madvise(map, size, MADV_WILLNEED);
+
+    const raw_texture_header_t* header;
+    try {
+        header = check_raw_texture(path, (const png_byte*) map, size);
+    } catch( ... ) {
+        munmap(map, size);
+        throw;
+    }
+
+    /* Stored mipmaps are used only if the chain is complete */
+    size_t full_chain = 1;
+    for( size_t s = std::max(header->width, header->height); s > 1; s /= 2 ) full_chain += 1;
+    texture_options_t level_options = options;
+    level_options.mipmaps = options.mipmaps && header->levels == full_chain;
+
+    GLuint texture_id = 0;
+    glGenTextures(1, &texture_id);
+    assert(texture_id != 0);
+    glBindTexture(GL_TEXTURE_2D, texture_id);
+    bool mipmaps = gl_texture_parameters(header->width, header->height, level_options);
+
+    size_t pixel_size = raw_pixel_size(header->format, header->type);
+    size_t uploaded = 0;
+    for( uint32_t i = 0; i < (mipmaps ? header->levels : 1); ++i ) {
+        size_t w = std::max(header->width >> i, (uint32_t) 1);
+        size_t h = std::max(header->height >> i, (uint32_t) 1);
+        glTexImage2D(GL_TEXTURE_2D, i, header->format, w, h, 0, header->format, header->type,
+                     (const png_byte*) map + header->offsets[i]);
+        uploaded += w * h * pixel_size;
+    }
+
+    if( width != NULL ) *width = header->width;
+    if( height != NULL ) *height = header->height;
+    if( bytes != NULL ) *bytes = uploaded;
+    if( flags != NULL ) *flags = header->flags;
+
+    munmap(map, size);
+    return texture_id;
+}
+
+bool is_raw_texture_file(const char* path) {
+    size_t len = strlen(path);
+    return len > 4 && strcmp(path + len - 4, ".tex") == 0;
+}
@@ -5,13 +5,82 @@
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
+/* PNG-files are decoded straight from their memory mapping. Textures are uploaded in strips of rows
+   while being decoded, so peak memory is a few rows rather than the whole image */
+
+/* How pixels are stored in textures */
+typedef struct {
+    /* Pack colour images into 16 bits per pixel: RGB565 if opaque, RGBA5551 if pixels are either
+       transparent or opaque, RGBA4444 otherwise. Greyscale images stay 1 or 2 bytes per pixel anyway */
+    bool packed;
+    /* Dither packed pixels instead of dropping low bits, so smooth gradients don't band */
+    bool dithered;
+    /* Build the mip chain and filter trilinearly when minified. Needs power of two sizes on GLES2
+       without GL_OES_texture_npot, other textures get plain linear filtering */
+    bool mipmaps;
+} texture_options_t;
+
+/* Full colour with mipmaps */
+extern const texture_options_t default_texture_options;
+
 /* Create EGL texture out of PNG-file */
 GLuint load_png_as_texture(const char* path);
 
 /* Create EGL texture out of PNG-file, get image size */
 GLuint load_png_as_texture(const char* path, size_t* width, size_t* height);
 
-/* Load PNG-file, get image size */
+/* Create EGL texture out of PNG-file with given storage options, get image size and GPU memory taken
+   by the texture (mipmaps included). Rows are decoded and uploaded in strips, except for interlaced
+   images and packed images with transparency, which are decoded whole to pick the same packed format
+   as create_texture() */
+GLuint load_png_as_texture(const char* path, const texture_options_t& options, size_t* width, size_t* height, size_t* bytes);
+
+/* Load PNG-file, get image size. Doesn't need GL context, free() the result */
 char* load_png_image(const char* path, size_t* width, size_t* height);
 
+/* Load PNG-file keeping greyscale images greyscale. 'format' gets GL_LUMINANCE, GL_LUMINANCE_ALPHA
+   or GL_RGBA. Doesn't need GL context, free() the result */
+char* load_png_image(const char* path, size_t* width, size_t* height, GLenum* format);
+
+/* Get PNG-file image size reading just the file header */
+void read_png_size(const char* path, size_t* width, size_t* height);
+
+/* Decode PNG-file into caller's buffer of RGBA pixels, image rows 'stride' bytes apart.
+   Throws if the image isn't of the given size */
+void load_png_image(const char* path, char* pixels, size_t width, size_t height, size_t stride);
+
+/* Create EGL texture out of RGBA pixels, e.g. loaded with load_png_image() */
+GLuint create_texture(const char* pixels, size_t width, size_t height);
+
+/* Create EGL texture out of RGBA pixels with given storage options */
+GLuint create_texture(const char* pixels, size_t width, size_t height, const texture_options_t& options);
+
+/* Create EGL texture out of GL_LUMINANCE, GL_LUMINANCE_ALPHA or GL_RGBA pixels with given storage options,
+   get GPU memory taken by the texture */
+GLuint create_texture(const char* pixels, size_t width, size_t height, GLenum format, const texture_options_t& options,
+                      size_t* bytes);
+
+/* Downscale GL_LUMINANCE, GL_LUMINANCE_ALPHA or GL_RGBA pixels to half size (at least 1x1), each pixel
+   is the average of 2x2 ones. 'half' must hold the next mipmap level */
+void halve_image(const char* pixels, size_t width, size_t height, GLenum format, char* half);
+
+/* Raw textures (.tex) are prebaked by texbake: pixels in upload format, mipmaps precomputed.
+   They are uploaded straight from a memory mapping, with no decoding and no copies */
+
+/* Alpha of raw texture pixels is premultiplied */
+#define RAW_TEXTURE_PREMULTIPLIED 1
+
+/* Convert PNG-file into a raw texture. Pixels are stored as create_texture() would upload them with given
+   options, mipmaps are computed if the options ask for them, alpha is premultiplied if 'premultiply' is set.
+   Returns size of the pixel data */
+size_t bake_raw_texture(const char* png_path, const char* path, const texture_options_t& options, bool premultiply);
+
+/* Create EGL texture out of a raw texture file. Stored mipmaps are used if the options ask for mipmaps,
+   packing is ignored. Get image size, GPU memory taken by the texture and RAW_TEXTURE_* flags */
+GLuint load_raw_texture(const char* path, const texture_options_t& options, size_t* width, size_t* height, size_t* bytes,
+                        unsigned* flags);
+
+/* Does the path name a raw texture */
+bool is_raw_texture_file(const char* path);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "shadercache.h"
+#include "cachefile.h"
+
+/* Cache file header */
+typedef struct {
+    char magic[8];
+    uint64_t key;
+    GLenum format;
+    GLint length;
+} cache_header_t;
+
+static const char CACHE_MAGIC[8] = { 'E', 'G', 'L', 'W', 'P', 'B', '0', '1' };
+
+ShaderCache::ShaderCache() {
+    getProgramBinary = NULL;
+    programBinary = NULL;
+
+    /* Driver must support the extension and at least one binary format */
+    const char* extensions = (const char*) glGetString(GL_EXTENSIONS);
+    if( extensions == NULL || strstr(extensions, "GL_OES_get_program_binary") == NULL ) return;
+
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &formats);
+    if( formats <= 0 ) return;
+
+    getProgramBinary = (PFNGLGETPROGRAMBINARYOESPROC) eglGetProcAddress("glGetProgramBinaryOES");
+    programBinary = (PFNGLPROGRAMBINARYOESPROC) eglGetProcAddress("glProgramBinaryOES");
+    if( getProgramBinary == NULL || programBinary == NULL ) return;
+
+    /* Choose cache directory */
+    dir = cache_directory("EGLWIDGET_SHADER_CACHE");
+}
+
+/* Hash shader sources and attribute bindings together with the driver identification */
+uint64_t ShaderCache::key(const std::string& vertex, const std::string& fragment, const std::vector<attribute_binding_t>& attributes) {
+    uint64_t hash = FNV1A_SEED;
+
+    /* Zero byte separates the parts, so that moving text between them changes the hash */
+    hash = fnv1a(hash, vertex.c_str(), vertex.size() + 1);
+    hash = fnv1a(hash, fragment.c_str(), fragment.size() + 1);
+
+    /* Bindings are linked into the binary */
+    for( size_t i = 0; i < attributes.size(); ++i ) {
+        hash = fnv1a(hash, (const char*) &attributes[i].index, sizeof(attributes[i].index));
+        hash = fnv1a(hash, attributes[i].name.c_str(), attributes[i].name.size() + 1);
+    }
+
+    const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for( size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); ++i ) {
+        const char* s = (const char*) glGetString(strings[i]);
+        if( s != NULL ) hash = fnv1a(hash, s, strlen(s) + 1);
+    }
+
+    return hash;
+}
+
+/* Cache file of a program */
+std::string ShaderCache::path(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+    return dir + name;
+}
+
+/* Load program from the cached binary */
+bool ShaderCache::load(GLuint program, const std::string& vertex, const std::string& fragment,
+                       const std::vector<attribute_binding_t>& attributes) {
+    if( ! enabled() ) return false;
+
+    uint64_t k = key(vertex, fragment, attributes);
+    std::string file = path(k);
+
+    FILE* fp = fopen(file.c_str(), "rb");
+    if( fp == NULL ) return false;
+
+    /* Read and check the header, then the binary itself. Its length must fit the file before
+       anything gets allocated for it */
+    cache_header_t header;
+    std::vector<char> binary;
+    long size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    bool ok = size >= (long) sizeof(header) && fseek(fp, 0, SEEK_SET) == 0
+           && fread(&header, sizeof(header), 1, fp) == 1
+           && memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+           && header.key == k
+           && header.length > 0 && header.length <= size - (long) sizeof(header);
+    if( ok ) {
+        binary.resize(header.length);
+        ok = fread(&binary[0], 1, binary.size(), fp) == binary.size();
+    }
+    fclose(fp);
+
+    if( ! ok ) {
+        printf("Shader cache: invalid file %s\n", file.c_str());
+        unlink(file.c_str());
+        return false;
+    }
+
+    /* Driver may refuse a binary e.g. after a firmware update, then we compile from source */
+    programBinary(program, header.format, &binary[0], header.length);
+
+    GLint status = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if( ! status ) {
+        printf("Shader cache: binary rejected by driver %s\n", file.c_str());
+        unlink(file.c_str());
+        return false;
+    }
+
+    printf("Shader cache: loaded %s\n", file.c_str());
+    return true;
+}
+
+/* Save linked program binary */
+void ShaderCache::store(GLuint program, const std::string& vertex, const std::string& fragment,
+                        const std::vector<attribute_binding_t>& attributes) {
+    if( ! enabled() ) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if( length <= 0 ) return;
+
+    cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.key = key(vertex, fragment, attributes);
+
+    /* Header followed by the binary */
+    std::vector<char> data(sizeof(header) + length);
+    getProgramBinary(program, length, &header.length, &header.format, &data[sizeof(header)]);
+    if( header.length <= 0 ) return;
+    data.resize(sizeof(header) + header.length);
+    memcpy(&data[0], &header, sizeof(header));
+
+    std::string file = path(header.key);
+    if( write_cache_file(dir, file, data) ) printf("Shader cache: saved %s\n", file.c_str());
+}
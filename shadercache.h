@@ -0,0 +1,51 @@
+#ifndef __SHADERCACHE_H__
+#define __SHADERCACHE_H__
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Attribute location bound before linking with glBindAttribLocation() */
+typedef struct {
+    GLuint index;
+    std::string name;
+} attribute_binding_t;
+
+/* On-disk cache of linked shader programs (GL_OES_get_program_binary).
+   Programs are keyed by a hash of vertex and fragment shader sources, attribute bindings and
+   GL driver strings, so a driver update or a shader change simply misses the cache.
+
+   Cache directory: $EGLWIDGET_SHADER_CACHE, $XDG_CACHE_HOME/eglwidgets or ~/.cache/eglwidgets.
+   Set EGLWIDGET_SHADER_CACHE to an empty string to disable the cache */
+class ShaderCache {
+private:
+    /* Cache directory, empty if the cache is disabled */
+    std::string dir;
+
+    PFNGLGETPROGRAMBINARYOESPROC getProgramBinary;
+    PFNGLPROGRAMBINARYOESPROC programBinary;
+
+    uint64_t key(const std::string& vertex, const std::string& fragment, const std::vector<attribute_binding_t>& attributes);
+    std::string path(uint64_t key);
+
+public:
+    /* Must be created with a current GL context */
+    ShaderCache();
+
+    bool enabled() { return ! dir.empty(); }
+
+    /* Load cached binary into a new program with the given attribute bindings. Returns false if there's
+       no valid binary, the program then has to be deleted */
+    bool load(GLuint program, const std::string& vertex, const std::string& fragment,
+              const std::vector<attribute_binding_t>& attributes);
+    /* Save linked program binary */
+    void store(GLuint program, const std::string& vertex, const std::string& fragment,
+               const std::vector<attribute_binding_t>& attributes);
+};
+
+#endif
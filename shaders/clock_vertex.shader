@@ -1,5 +1,5 @@
 uniform mat4 mvp;
-uniform float frames;
+uniform mediump float frames;
 
 attribute vec4 vertex_xyz;
 attribute vec2 vertex_st;
@@ -0,0 +1,8 @@
+precision mediump float;
+
+uniform sampler2D u_texture;
+varying vec2 v_st;
+
+void main() {
+    gl_FragColor = texture2D(u_texture, v_st);
+}
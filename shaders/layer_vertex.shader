@@ -0,0 +1,7 @@
+attribute vec2 vertex_xy;
+varying vec2 v_st;
+
+void main() {
+    gl_Position = vec4(vertex_xy, 0.0, 1.0);
+    v_st = vertex_xy * 0.5 + 0.5;
+}
@@ -0,0 +1,10 @@
+uniform mat4 mvp;
+
+attribute vec2 vertex_xy;
+attribute vec2 vertex_st;
+varying vec2 v_st;
+
+void main() {
+    gl_Position = mvp * vec4(vertex_xy, 0.0, 1.0);
+    v_st = vertex_st;
+}
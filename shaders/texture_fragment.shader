@@ -2,9 +2,14 @@ precision mediump float;
 
 uniform float frames;
 uniform sampler2D u_texture;
+/* Alpha plane of ETC1 textures, used if u_alpha_plane is 1 */
+uniform sampler2D u_alpha;
+uniform float u_alpha_plane;
 varying vec2 v_st;
 
 void main() {
     vec2 flipped = vec2(v_st.x, 1.0 - v_st.y);
-    gl_FragColor = texture2D(u_texture, flipped);
+    vec4 color = texture2D(u_texture, flipped);
+    float alpha = mix(color.a, texture2D(u_alpha, flipped).g, u_alpha_plane);
+    gl_FragColor = vec4(color.rgb, alpha);
 }
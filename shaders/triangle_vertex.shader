@@ -1,5 +1,5 @@
 uniform mat4 mvp;
-uniform float frames;
+uniform mediump float frames;
 
 attribute vec4 pos;
 attribute vec4 color;
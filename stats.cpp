@@ -0,0 +1,46 @@
+#include <stdio.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "stats.h"
+
+/* Phase name used in the reports */
+const char* FrameStats::phaseName(phase_t phase) {
+    static const char* names[PHASE_COUNT] = { "update", "draw", "swap", "upload", "frame", "sleep" };
+    return names[phase];
+}
+
+/* Save statistics as JSON. Every phase is written on its own line so that
+   results can be compared with line-oriented tools (see bench/run.sh) */
+void FrameStats::write(const char* path, uint64_t frames, uint64_t gl_issued, uint64_t gl_elided) {
+    FILE* fp = fopen(path, "w");
+    if( fp == NULL ) throw std::runtime_error(std::string("Cannot create benchmark results: ") + path);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"frames\": %llu,\n", (unsigned long long) frames);
+    fprintf(fp, "  \"gl_calls_per_frame\": { \"issued\": %.1f, \"elided\": %.1f },\n",
+            frames ? (double) gl_issued / frames : 0.0, frames ? (double) gl_elided / frames : 0.0);
+    fprintf(fp, "  \"phases\": {\n");
+
+    for( int i = 0; i < PHASE_COUNT; ++i ) {
+        std::vector<uint64_t> v(samples[i]);
+        std::sort(v.begin(), v.end());
+
+        /* Microseconds */
+        double min = 0, median = 0, p99 = 0;
+        if( ! v.empty() ) {
+            min = v[0] / 1000.0;
+            median = v[v.size() / 2] / 1000.0;
+            p99 = v[std::min(v.size() - 1, v.size() * 99 / 100)] / 1000.0;
+        }
+
+        fprintf(fp, "    \"%s\": { \"count\": %zu, \"min\": %.1f, \"median\": %.1f, \"p99\": %.1f }%s\n",
+                phaseName((phase_t) i), v.size(), min, median, p99, i + 1 < PHASE_COUNT ? "," : "");
+    }
+
+    fprintf(fp, "  }\n");
+    fprintf(fp, "}\n");
+    fclose(fp);
+}
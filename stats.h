@@ -0,0 +1,49 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+/* Per-phase frame timings, collected in benchmark mode */
+class FrameStats {
+public:
+    /* Frame phases */
+    typedef enum {
+        /* CPU work in update() */
+        PHASE_UPDATE,
+        /* GL command submission in draw() */
+        PHASE_DRAW,
+        /* eglSwapBuffers() */
+        PHASE_SWAP,
+        /* Texture uploads, reported by widgets */
+        PHASE_UPLOAD,
+        /* Whole frame */
+        PHASE_FRAME,
+        /* Main loop waiting for the next frame */
+        PHASE_SLEEP,
+        PHASE_COUNT
+    } phase_t;
+
+private:
+    /* Raw samples, nanoseconds */
+    std::vector<uint64_t> samples[PHASE_COUNT];
+    /* Update and draw may run on different threads */
+    std::mutex lock;
+
+public:
+    FrameStats() {}
+
+    /* Add one sample */
+    void add(phase_t phase, uint64_t ns) {
+        std::lock_guard<std::mutex> guard(lock);
+        samples[phase].push_back(ns);
+    }
+
+    /* Save min/median/p99 of every phase and GL state calls per frame as JSON file */
+    void write(const char* path, uint64_t frames, uint64_t gl_issued, uint64_t gl_elided);
+
+    static const char* phaseName(phase_t phase);
+};
+
+#endif
@@ -0,0 +1,236 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "statusbar.h"
+#include "shaders/statusbar_vertex.h"
+#include "shaders/statusbar_fragment.h"
+
+/* Icon size in pixels */
+static const int ICON = 32;
+
+/* Vertex shader file */
+const char* StatusBar::vertexShader() {
+    return "shaders/statusbar_vertex.shader";
+}
+
+/* Pixel shader file */
+const char* StatusBar::fragmentShader() {
+    return "shaders/statusbar_fragment.shader";
+}
+
+/* Shader sources embedded at build time */
+const char* StatusBar::vertexShaderSource() {
+    return statusbar_vertex_shader;
+}
+
+const char* StatusBar::fragmentShaderSource() {
+    return statusbar_fragment_shader;
+}
+
+/* Fill rectangle x0, y0 - x1, y1 (exclusive) of an icon with colour */
+static void fill_rect(std::vector<char>& icon, int x0, int y0, int x1, int y1, const unsigned char color[4]) {
+    for( int y = y0; y < y1; ++y )
+        for( int x = x0; x < x1; ++x ) memcpy(&icon[(y * ICON + x) * 4], color, 4);
+}
+
+/* Signal strength: 4 bars growing to the right, 'level' of them lit */
+static std::vector<char> signal_icon(int level) {
+    static const unsigned char lit[4] = { 255, 255, 255, 255 };
+    static const unsigned char dim[4] = { 90, 90, 90, 255 };
+
+    std::vector<char> icon(ICON * ICON * 4, 0);
+    for( int bar = 0; bar < 4; ++bar )
+        fill_rect(icon, 2 + bar * 8, 22 - bar * 6, 8 + bar * 8, 30, bar < level ? lit : dim);
+    return icon;
+}
+
+/* Battery outline filled to 'level' of 4, red when nearly empty */
+static std::vector<char> battery_icon(int level) {
+    static const unsigned char outline[4] = { 255, 255, 255, 255 };
+    static const unsigned char empty[4] = { 0, 0, 0, 0 };
+    static const unsigned char good[4] = { 80, 220, 80, 255 };
+    static const unsigned char low[4] = { 230, 50, 40, 255 };
+
+    std::vector<char> icon(ICON * ICON * 4, 0);
+    fill_rect(icon, 1, 8, 27, 24, outline);
+    fill_rect(icon, 3, 10, 25, 22, empty);
+    fill_rect(icon, 27, 12, 30, 20, outline);
+    fill_rect(icon, 5, 12, 5 + 19 * level / 4, 20, level > 1 ? good : low);
+    return icon;
+}
+
+/* Round indicator with smooth edges */
+static std::vector<char> led_icon(const unsigned char color[3]) {
+    std::vector<char> icon(ICON * ICON * 4);
+    for( int y = 0; y < ICON; ++y ) {
+        for( int x = 0; x < ICON; ++x ) {
+            float distance = hypotf(x + 0.5f - ICON / 2, y + 0.5f - ICON / 2);
+            float coverage = std::min(std::max(ICON / 2 - 2 - distance, 0.0f), 1.0f);
+
+            char* p = &icon[(y * ICON + x) * 4];
+            memcpy(p, color, 3);
+            p[3] = (char) (coverage * 255 + 0.5f);
+        }
+    }
+    return icon;
+}
+
+/* Draw icons on a worker thread */
+void StatusBar::load() {
+    static const unsigned char green[3] = { 60, 230, 90 };
+    static const unsigned char grey[3] = { 60, 60, 60 };
+    char name[32];
+
+    for( int level = 0; level < LEVELS; ++level ) {
+        snprintf(name, sizeof(name), "signal%d", level);
+        signal_icons[level] = atlas.add(name, signal_icon(level).data(), ICON, ICON);
+        snprintf(name, sizeof(name), "battery%d", level);
+        battery_icons[level] = atlas.add(name, battery_icon(level).data(), ICON, ICON);
+    }
+    led_on = atlas.add("led_on", led_icon(green).data(), ICON, ICON);
+    led_off = atlas.add("led_off", led_icon(grey).data(), ICON, ICON);
+}
+
+/* Assign shader parameters before the shader program gets linked */
+void StatusBar::bindAttributes() {
+    bindAttribute(attr_xy, "vertex_xy");
+    bindAttribute(attr_st, "vertex_st");
+}
+
+/* Initialization before the main loop */
+void StatusBar::prepare() {
+    /* Call parent */
+    EGLWidget::prepare();
+
+    /* Icons are drawn smaller than their size, so they need mipmaps */
+    uint64_t start = FramePacer::now();
+    atlas.upload(default_texture_options);
+    recordPhase(FrameStats::PHASE_UPLOAD, start);
+    printf("Status bar: %zu icons in %zu atlas pages\n", (size_t) (2 * LEVELS + 2), atlas.getPageCount());
+
+    /* Pixels to clip space, y pointing down */
+    memset(mvp, 0, sizeof(mvp));
+    mvp[0] = 2.0f / width;
+    mvp[5] = -2.0f / height;
+    mvp[10] = 1;
+    mvp[12] = -1;
+    mvp[13] = 1;
+    mvp[15] = 1;
+
+    glGenBuffers(1, &vert_buf);
+    glGenBuffers(1, &index_buf);
+    u_texture = glGetUniformLocation(program, "u_texture");
+}
+
+/* Bind our buffers and the atlas page. All icons fit one page */
+void StatusBar::bind() {
+    /* Call parent */
+    EGLWidget::bind();
+
+    gl->enable(GL_BLEND);
+    gl->blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    /* Vertex structure: x, y, s, t floats */
+    gl->bindBuffer(GL_ARRAY_BUFFER, vert_buf);
+    gl->enableVertexAttribArray(attr_xy);
+    glVertexAttribPointer(attr_xy, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), 0);
+    gl->enableVertexAttribArray(attr_st);
+    glVertexAttribPointer(attr_st, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (void*) (2 * sizeof(GLfloat)));
+    gl->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+
+    gl->uniform1i(u_texture, 0);
+    gl->activeTexture(GL_TEXTURE0);
+    gl->bindTexture(GL_TEXTURE_2D, atlas.get(led_on)->texture);
+}
+
+/* Refresh the indicators once a second */
+void StatusBar::update() {
+    tick += 1;
+
+    state_t& next = state.back();
+    next.signal = (tick / 2) % LEVELS;
+    next.battery = LEVELS - 1 - (tick / 5) % LEVELS;
+    /* Some activity to show */
+    uint32_t bits = tick * 2654435761u;
+    next.leds = bits ^ (bits >> 15);
+    state.publish();
+
+    next_update = FramePacer::now() + 1000000000ULL;
+
+    /* Call parent */
+    EGLWidget::update();
+}
+
+uint64_t StatusBar::nextWakeup(uint64_t now) {
+    return std::max(now, next_update);
+}
+
+/* Put quads of all icons into the buffers: signal and battery at the left, indicators at the right */
+void StatusBar::buildBatch(const state_t& shown) {
+    std::vector<GLfloat> vertices;
+    std::vector<GLushort> indexes;
+
+    GLfloat top = (height - ICON) / 2.0f;
+    Atlas::addQuad(*atlas.get(signal_icons[shown.signal]), 8, top, 8 + ICON, top + ICON, vertices, indexes);
+    Atlas::addQuad(*atlas.get(battery_icons[shown.battery]), 48, top, 48 + ICON, top + ICON, vertices, indexes);
+
+    /* Indicators at half size */
+    GLfloat size = ICON / 2, step = size + 4;
+    GLfloat left = width - LEDS * step - 4;
+    for( int i = 0; i < LEDS; ++i ) {
+        const Atlas::region_t* led = atlas.get(shown.leds & (1u << i) ? led_on : led_off);
+        Atlas::addQuad(*led, left + i * step, (height - size) / 2, left + i * step + size, (height + size) / 2, vertices, indexes);
+    }
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, vert_buf);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_DYNAMIC_DRAW);
+    gl->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexes.size() * sizeof(GLushort), indexes.data(), GL_DYNAMIC_DRAW);
+    index_count = indexes.size();
+}
+
+/* Draw one frame */
+void StatusBar::draw() {
+    /* Call parent */
+    EGLWidget::draw();
+
+    /* Take the latest state from update() */
+    if( state.fetch() || index_count == 0 ) buildBatch(state.front());
+
+    gl->uniformMatrix4fv(u_mvp, mvp);
+    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_SHORT, 0);
+}
+
+/* Initialization */
+StatusBar::StatusBar(): EGLWidget(0, 0, 1000, 40), atlas(256, 256, 2) {
+    tick = 0;
+    next_update = 0;
+    memset(signal_icons, 0, sizeof(signal_icons));
+    memset(battery_icons, 0, sizeof(battery_icons));
+    led_on = led_off = 0;
+    /* Fixed attribute locations, bound before linking */
+    attr_xy = 0;
+    attr_st = 1;
+    u_texture = -1;
+    vert_buf = 0;
+    index_buf = 0;
+    index_count = 0;
+}
+
+#ifndef EGLWIDGET_NO_MAIN
+int main(void) {
+#ifdef IS_RPI
+    bcm_host_init();
+#endif
+    try {
+        StatusBar status;
+        status.run(2);
+    } catch (const std::exception& ex) {
+        fprintf(stderr, "Error: %s", ex.what());
+    }
+}
+#endif
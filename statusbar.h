@@ -0,0 +1,66 @@
+#ifndef __STATUSBAR_H__
+#define __STATUSBAR_H__
+
+#include "widget.h"
+#include "triplebuffer.h"
+#include "atlas.h"
+
+/* Status bar: signal, battery and activity indicator icons packed into a texture atlas,
+   all of them drawn with one call */
+class StatusBar: public EGLWidget {
+private:
+    /* Activity indicators in a row */
+    static const int LEDS = 16;
+    /* Signal and battery icons of 0..LEVELS-1 bars */
+    static const int LEVELS = 5;
+
+    /* State passed from update() to draw(), which may run on different threads */
+    typedef struct {
+        int signal;
+        int battery;
+        /* Bit per activity indicator */
+        uint32_t leds;
+    } state_t;
+    TripleBuffer<state_t> state;
+
+    /* Seconds since start */
+    unsigned tick;
+    uint64_t next_update;
+
+    /* Icons, images of the atlas made by load() */
+    Atlas atlas;
+    int signal_icons[LEVELS];
+    int battery_icons[LEVELS];
+    int led_on;
+    int led_off;
+
+    /* Pixel coordinates, origin at the top left corner */
+    GLfloat mvp[16];
+    /* Shader parameters */
+    GLint attr_xy;
+    GLint attr_st;
+    GLint u_texture;
+
+    /* Batch of all icons, rebuilt when the state changes */
+    GLuint vert_buf;
+    GLuint index_buf;
+    GLsizei index_count;
+
+    void buildBatch(const state_t& shown);
+
+public:
+    StatusBar();
+    virtual void load();
+    virtual void bindAttributes();
+    virtual void prepare();
+    virtual void bind();
+    virtual void update();
+    virtual uint64_t nextWakeup(uint64_t now);
+    virtual void draw();
+    virtual const char* vertexShader();
+    virtual const char* fragmentShader();
+    virtual const char* vertexShaderSource();
+    virtual const char* fragmentShaderSource();
+};
+
+#endif
@@ -0,0 +1,169 @@
+/* Compares vector pixel kernels with the plain C ones. Run with 'make check'.
+
+   pixels.cpp is built into the test, so its plain C kernels give the expected results. Every kernel
+   runs over all tail lengths 0..15 after whole vectors and from all unaligned source and destination
+   starts, bytes after the last pixel must stay untouched */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "pixels.cpp"
+
+/* Pixel counts: tails alone, then after 1 and 3 vectors of any width */
+static const size_t BASES[] = { 0, 16, 48 };
+static const size_t MAX_TAIL = 16;
+static const size_t MAX_SHIFT = 16;
+static const size_t MAX_COUNT = 48 + MAX_TAIL;
+
+/* Bytes after output, to catch writes past the end */
+static const size_t GUARD = 32;
+static const unsigned char GUARD_BYTE = 0xA5;
+
+static const GLenum PACKED_TYPES[] = { GL_UNSIGNED_SHORT_5_6_5, GL_UNSIGNED_SHORT_5_5_5_1, GL_UNSIGNED_SHORT_4_4_4_4 };
+
+static int failures = 0;
+
+/* Compare 'size' bytes with the expected ones and check the guard after them */
+static void compare(const char* kernel, const void* result, const void* expected, size_t size,
+                    size_t count, size_t source_shift, size_t shift) {
+    const unsigned char* guard = (const unsigned char*) result + size;
+    bool guard_ok = true;
+    for( size_t i = 0; i < GUARD; ++i ) guard_ok &= guard[i] == GUARD_BYTE;
+
+    if( memcmp(result, expected, size) != 0 || ! guard_ok ) {
+        if( failures < 20 )
+            printf("FAIL %s: %zu pixels, source at +%zu, destination at +%zu%s\n", kernel, count, source_shift, shift,
+                   guard_ok ? "" : ", wrote past the end");
+        ++failures;
+    }
+}
+
+/* Random pixels with fully transparent and opaque ones mixed in, as images have them */
+static void fill(unsigned char* data, size_t size) {
+    for( size_t i = 0; i < size; ++i ) data[i] = rand();
+    for( size_t i = 3; i < size; i += 4 * 5 ) data[i] = (i / 4) % 2 ? 0 : 255;
+}
+
+static void check_premultiply(const unsigned char* source, unsigned char* output, size_t count, size_t source_shift, size_t shift) {
+    unsigned char expected[MAX_COUNT * 4];
+    premultiply_scalar(source, expected, count);
+
+    memset(output, GUARD_BYTE, count * 4 + GUARD);
+    premultiply_pixels(source, output, count);
+    compare("premultiply", output, expected, count * 4, count, source_shift, shift);
+
+    /* In place */
+    memcpy(output, source, count * 4);
+    premultiply_pixels(output, output, count);
+    compare("premultiply in place", output, expected, count * 4, count, shift, shift);
+}
+
+static void check_pack(const unsigned char* source, unsigned char* output, size_t count, size_t source_shift, size_t shift) {
+    static const unsigned char none[16] = { 0 };
+    char name[64];
+
+    for( size_t t = 0; t < sizeof(PACKED_TYPES) / sizeof(PACKED_TYPES[0]); ++t ) {
+        uint16_t expected[MAX_COUNT];
+
+        pack_scalar(source, expected, 0, count, PACKED_TYPES[t], none);
+        memset(output, GUARD_BYTE, count * 2 + GUARD);
+        pack_pixels(source, (uint16_t*) output, count, PACKED_TYPES[t]);
+        snprintf(name, sizeof(name), "pack 0x%04x", PACKED_TYPES[t]);
+        compare(name, output, expected, count * 2, count, source_shift, shift);
+
+        for( size_t y = 0; y < 4; ++y ) {
+            unsigned char offsets[16];
+            dither_offsets(y, PACKED_TYPES[t], offsets);
+            pack_scalar(source, expected, 0, count, PACKED_TYPES[t], offsets);
+            memset(output, GUARD_BYTE, count * 2 + GUARD);
+            pack_pixels_dithered(source, (uint16_t*) output, count, y, PACKED_TYPES[t]);
+            snprintf(name, sizeof(name), "dithered pack 0x%04x, row %zu", PACKED_TYPES[t], y);
+            compare(name, output, expected, count * 2, count, source_shift, shift);
+        }
+    }
+}
+
+static void check_colorize(const unsigned char* coverage, unsigned char* output, size_t count, size_t source_shift, size_t shift) {
+    static const unsigned char colors[][4] = { { 255, 255, 255, 255 }, { 255, 102, 0, 255 }, { 13, 200, 77, 128 }, { 0, 0, 0, 0 } };
+
+    for( size_t c = 0; c < sizeof(colors) / sizeof(colors[0]); ++c ) {
+        unsigned char expected[MAX_COUNT * 4];
+        colorize_scalar(coverage, expected, count, colors[c]);
+
+        memset(output, GUARD_BYTE, count * 4 + GUARD);
+        colorize_coverage(coverage, output, count, colors[c]);
+        compare("colorize", output, expected, count * 4, count, source_shift, shift);
+    }
+}
+
+/* Every colour and alpha pair must round to nearest */
+static void check_premultiply_rounding() {
+    std::vector<unsigned char> pixels(256 * 256 * 4);
+    for( int a = 0; a < 256; ++a ) {
+        for( int c = 0; c < 256; ++c ) {
+            unsigned char* p = &pixels[(a * 256 + c) * 4];
+            p[0] = c;
+            p[1] = 255 - c;
+            p[2] = c;
+            p[3] = a;
+        }
+    }
+
+    premultiply_pixels(pixels.data(), pixels.data(), 256 * 256);
+
+    for( int a = 0; a < 256; ++a ) {
+        for( int c = 0; c < 256; ++c ) {
+            const unsigned char* p = &pixels[(a * 256 + c) * 4];
+            if( p[0] != (c * a + 127) / 255 || p[1] != ((255 - c) * a + 127) / 255 || p[3] != a ) {
+                if( failures < 20 ) printf("FAIL premultiply rounding: colour %d, alpha %d\n", c, a);
+                ++failures;
+            }
+        }
+    }
+}
+
+int main() {
+#if defined(__SSE2__)
+    const char* path = "SSE2";
+#elif defined(PIXELS_NEON)
+    const char* path = "NEON";
+#else
+    const char* path = NULL;
+#endif
+    if( path == NULL || ! use_simd() ) {
+        printf("Pixel kernels: no vector code in this build, plain C only\n");
+        path = "plain C";
+    }
+
+    srand(1);
+    unsigned char source[MAX_COUNT * 4 + MAX_SHIFT];
+    unsigned char coverage[MAX_COUNT + MAX_SHIFT];
+    unsigned char output[MAX_COUNT * 4 + MAX_SHIFT + GUARD];
+    fill(source, sizeof(source));
+    for( size_t i = 0; i < sizeof(coverage); ++i ) coverage[i] = i % 7 == 0 ? 0 : i % 11 == 0 ? 255 : rand();
+
+    size_t runs = 0;
+    for( size_t b = 0; b < sizeof(BASES) / sizeof(BASES[0]); ++b ) {
+        for( size_t tail = 0; tail < MAX_TAIL; ++tail ) {
+            size_t count = BASES[b] + tail;
+            for( size_t source_shift = 0; source_shift < MAX_SHIFT; ++source_shift ) {
+                for( size_t shift = 0; shift < MAX_SHIFT; ++shift ) {
+                    check_premultiply(source + source_shift, output + shift, count, source_shift, shift);
+                    /* Packed pixels are 16-bit aligned, as in any real buffer */
+                    check_pack(source + source_shift, output + (shift & ~1), count, source_shift, shift & ~1);
+                    check_colorize(coverage + source_shift, output + shift, count, source_shift, shift);
+                    ++runs;
+                }
+            }
+        }
+    }
+    check_premultiply_rounding();
+
+    if( failures > 0 ) {
+        printf("Pixel kernels (%s): %d failures\n", path, failures);
+        return 1;
+    }
+    printf("Pixel kernels (%s): %zu length and alignment cases match plain C\n", path, runs);
+    return 0;
+}
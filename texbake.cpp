@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+
+#include "pngloader.h"
+
+/* Converts PNG-files into raw textures, which load_raw_texture() uploads without decoding:
+
+   texbake [--packed] [--dithered] [--no-mipmaps] [--premultiplied] image.png image.tex
+
+   --packed         16-bit pixels for colour images (RGB565, RGBA5551 or RGBA4444)
+   --dithered       16-bit pixels, dithered so smooth gradients don't band
+   --no-mipmaps     store the full size image only
+   --premultiplied  premultiply colour by alpha, draw with glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA) */
+
+int main(int argc, char** argv) {
+    texture_options_t options = default_texture_options;
+    bool premultiply = false;
+
+    int arg = 1;
+    for( ; arg < argc && strncmp(argv[arg], "--", 2) == 0; ++arg ) {
+        if( strcmp(argv[arg], "--packed") == 0 ) options.packed = true;
+        else if( strcmp(argv[arg], "--dithered") == 0 ) options.packed = options.dithered = true;
+        else if( strcmp(argv[arg], "--no-mipmaps") == 0 ) options.mipmaps = false;
+        else if( strcmp(argv[arg], "--premultiplied") == 0 ) premultiply = true;
+        else break;
+    }
+
+    if( argc - arg != 2 || ! is_raw_texture_file(argv[arg + 1]) ) {
+        fprintf(stderr, "Usage: %s [--packed] [--dithered] [--no-mipmaps] [--premultiplied] image.png image.tex\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        size_t size = bake_raw_texture(argv[arg], argv[arg + 1], options, premultiply);
+        printf("%s: %zu KB\n", argv[arg + 1], size / 1024);
+    } catch( const std::exception& ex ) {
+        fprintf(stderr, "Error: %s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
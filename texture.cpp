@@ -1,8 +1,11 @@
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "texture.h"
-#include "pngloader.h"
+#include "shaders/texture_vertex.h"
+#include "shaders/texture_fragment.h"
+#include "texturemanager.h"
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -20,6 +23,15 @@ const char* Texture::fragmentShader() {
     return "shaders/texture_fragment.shader";
 }
 
+/* Shader sources embedded at build time */
+const char* Texture::vertexShaderSource() {
+    return texture_vertex_shader;
+}
+
+const char* Texture::fragmentShaderSource() {
+    return texture_fragment_shader;
+}
+
 /* Plane made of two triangles */
 /*
   B +----------+ A          x: +1           t: 1
@@ -45,53 +57,83 @@ static const GLushort indexes[] = {
     0, 2, 3,                        /* A -> C -> D */
 };
 
+/* Decode PNG-file on a worker thread. Widgets showing the same file share the decoded image.
+   ETC1 files (.ktx, .pkm) made by etc1pack and raw textures (.tex) made by texbake are uploaded as they are */
+void Texture::load() {
+    TextureManager::shared().preload(file_name);
+}
+
 /* Initialization before the main loop */
 void Texture::prepare() {
     /* Call parent */
     EGLWidget::prepare();
 
-    /* Enable transparency */
-    glEnable (GL_BLEND);
-    glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
     /* Load vertexes */
-    GLuint vert_buf;
     glGenBuffers(1, &vert_buf);
     glBindBuffer(GL_ARRAY_BUFFER, vert_buf);
     glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
 
-    /* Create shader parameter 'vertex_xyz' which represents a vertex */
+    /* Get shader parameters 'vertex_xyz' and 'vertex_st' which represent a vertex and texture coordinates */
     v_xyz = glGetAttribLocation(program, "vertex_xyz");
-    glEnableVertexAttribArray(v_xyz);
-    /* Vertex structure: 3 float-s per coordinate, total 5 floats, coordinate data starts at index 0 */
-    glVertexAttribPointer(v_xyz, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
-
-    /* Prepare shader parameter 'vertex"st' which represent texture coordinates */
     v_st  = glGetAttribLocation(program, "vertex_st");
-    glEnableVertexAttribArray(v_st);
-    /* Texture structure: 2 floats per texture coordinate, total 5 floats, texture data starts at index 3 */
-    glVertexAttribPointer(v_st, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
 
     /* Load our triangle into the buffer */
-    GLuint index_buf;
     glGenBuffers(1, &index_buf);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indexes), indexes, GL_STATIC_DRAW);
 
-    /* Load PNG-file as a texture */
-    glEnable (GL_TEXTURE_2D);
-    texture_id = load_png_as_texture(file_name);
+    /* Upload image preloaded by load(). It's drawn scaled down, so it needs mipmaps */
+    texture_options_t options = default_texture_options;
+    const char* packed = getenv("EGLWIDGET_PACKED_TEXTURES");
+    options.packed = packed != NULL && strcmp(packed, "0") != 0;
+    options.dithered = packed != NULL && strcmp(packed, "dither") == 0;
+
+    uint64_t start = FramePacer::now();
+    texture = TextureManager::shared().acquire(file_name, options);
+    recordPhase(FrameStats::PHASE_UPLOAD, start);
 
     /* Create shader parameter which represent our texture */
     u_texture = glGetUniformLocation(program, "u_texture");
-    printf("Texture id: %d, u_texture: %d\n", texture_id, u_texture);
+    u_alpha = glGetUniformLocation(program, "u_alpha");
+    u_alpha_plane = glGetUniformLocation(program, "u_alpha_plane");
+    printf("Texture id: %d, u_texture: %d\n", texture.getId(), u_texture);
 }
 
-/* Draw one frame */
-void Texture::draw() {
+/* Bind our buffers and texture */
+void Texture::bind() {
     /* Call parent */
-    EGLWidget::draw();
+    EGLWidget::bind();
+
+    /* Enable transparency */
+    gl->enable(GL_BLEND);
+    gl->blendFunc(texture.isPremultiplied() ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    gl->bindBuffer(GL_ARRAY_BUFFER, vert_buf);
+
+    /* Vertex structure: 3 float-s per coordinate, total 5 floats, coordinate data starts at index 0 */
+    gl->enableVertexAttribArray(v_xyz);
+    glVertexAttribPointer(v_xyz, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), 0);
+
+    /* Texture structure: 2 floats per texture coordinate, total 5 floats, texture data starts at index 3 */
+    gl->enableVertexAttribArray(v_st);
+    glVertexAttribPointer(v_st, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+
+    gl->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buf);
 
+    /* Transparent ETC1 texture has its alpha in another one */
+    gl->uniform1i(u_alpha, 1);
+    gl->uniform1f(u_alpha_plane, texture.getAlphaId() != 0 ? 1.0 : 0.0);
+    if( texture.getAlphaId() != 0 ) {
+        gl->activeTexture(GL_TEXTURE1);
+        gl->bindTexture(GL_TEXTURE_2D, texture.getAlphaId());
+    }
+
+    gl->activeTexture(GL_TEXTURE0);
+    gl->bindTexture(GL_TEXTURE_2D, texture.getId());
+}
+
+/* Animate widget: redraw every frame */
+void Texture::update() {
     /* Rotate our plane */
     angle += 0.01;
 
@@ -101,8 +143,24 @@ void Texture::draw() {
     mat4 scaled = scale(rotated, vec3(0.75, 0.75, 0.75));
     mat4 mvp = rotated * scaled;
 
+    /* Hand it over to draw() */
+    memcpy(state.back().mvp, glm::value_ptr(mvp), sizeof(state.back().mvp));
+    state.publish();
+
+    /* Call parent */
+    EGLWidget::update();
+}
+
+/* Draw one frame */
+void Texture::draw() {
+    /* Call parent */
+    EGLWidget::draw();
+
+    /* Take the latest state from update() */
+    state.fetch();
+
     /* Pass matrix to our shader */
-    glUniformMatrix4fv(u_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+    gl->uniformMatrix4fv(u_mvp, state.front().mvp);
 
     /* Draw triangles */
     glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
@@ -114,9 +172,14 @@ Texture::Texture(const char* file): EGLWidget(0, 900, 180, 180) {
     v_xyz = 0;
     v_st = 0;
     u_texture = -1;
+    u_alpha = -1;
+    u_alpha_plane = -1;
+    vert_buf = 0;
+    index_buf = 0;
     file_name = file;
 }
 
+#ifndef EGLWIDGET_NO_MAIN
 int main(int argc, char** argv) {
 #ifdef IS_RPI
     bcm_host_init();
@@ -129,3 +192,4 @@ int main(int argc, char** argv) {
         fprintf(stderr, "Error: %s", ex.what());
     }
 }
+#endif
@@ -2,27 +2,46 @@
 #define __TEXTURE_H__
 
 #include "widget.h"
+#include "triplebuffer.h"
+#include "texturemanager.h"
 
 /* Widget implements a rotating PNG-image */
 class Texture: public EGLWidget {
 private:
+    /* State passed from update() to draw(), which may run on different threads */
+    typedef struct {
+        /* Model-view-projection matrix */
+        GLfloat mvp[16];
+    } state_t;
+    TripleBuffer<state_t> state;
+
     /* Rotation angle */
     GLfloat angle;
     /* Shader parameters */
     GLint v_xyz;
     GLint v_st;
     GLuint u_texture;
-    /* Texture descriptor */
-    GLuint texture_id;
+    GLint u_alpha;
+    GLint u_alpha_plane;
+    /* Texture shared with other widgets showing the same file */
+    TextureManager::Handle texture;
+    /* Vertex and index buffers */
+    GLuint vert_buf;
+    GLuint index_buf;
     /* PNG-file path */
     const char* file_name;
 
 public:
     Texture(const char* file);
+    virtual void load();
     virtual void prepare();
+    virtual void bind();
+    virtual void update();
     virtual void draw();
     virtual const char* vertexShader();
     virtual const char* fragmentShader();
+    virtual const char* vertexShaderSource();
+    virtual const char* fragmentShaderSource();
 };
 
 #endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+
+#include "texturemanager.h"
+#include "etc1.h"
+
+TextureManager::TextureManager() {
+    used = 0;
+    budget = 0;
+    ticks = 0;
+
+    const char* env = getenv("EGLWIDGET_TEXTURE_BUDGET");
+    if( env != NULL ) budget = (size_t) atol(env) * 1024 * 1024;
+}
+
+TextureManager::~TextureManager() {
+    for( auto it = entries.begin(); it != entries.end(); ++it ) delete it->second;
+}
+
+/* Same file uploaded with different options is a different texture */
+std::string TextureManager::key(const std::string& path, const texture_options_t& options) {
+    return path + (options.packed ? (options.dithered ? ":dithered" : ":packed") : ":full") + (options.mipmaps ? ":mipmaps" : "");
+}
+
+/* Decode the file unless it's being decoded already. Errors are thrown to the first caller
+   and once again by acquire() */
+void TextureManager::preload(const std::string& path) {
+    if( is_etc1_file(path) || is_raw_texture_file(path.c_str()) ) return;
+
+    std::promise<std::shared_ptr<image_t> > decoded;
+    {
+        std::lock_guard<std::mutex> guard(images_lock);
+        if( images.find(path) != images.end() ) return;
+        images[path] = decoded.get_future().share();
+    }
+
+    try {
+        std::shared_ptr<image_t> image(new image_t());
+        image->pixels = NULL;
+        image->pixels = load_png_image(path.c_str(), &image->width, &image->height, &image->format);
+        decoded.set_value(image);
+    } catch( ... ) {
+        decoded.set_exception(std::current_exception());
+        throw;
+    }
+}
+
+/* Find cached texture or upload a new one */
+TextureManager::Handle TextureManager::acquire(const std::string& path, const texture_options_t& options) {
+    std::string name = key(path, options);
+    auto found = entries.find(name);
+    if( found != entries.end() ) {
+        /* Preloaded again by another widget */
+        std::lock_guard<std::mutex> guard(images_lock);
+        images.erase(path);
+        return Handle(this, found->second);
+    }
+
+    /* Take the preloaded image, if any. It's uploaded once, other options decode the file again */
+    std::shared_future<std::shared_ptr<image_t> > preloaded;
+    {
+        std::lock_guard<std::mutex> guard(images_lock);
+        auto image = images.find(path);
+        if( image != images.end() ) {
+            preloaded = image->second;
+            images.erase(image);
+        }
+    }
+
+    entry_t* entry = new entry_t();
+    entry->alpha_id = 0;
+    entry->premultiplied = false;
+    try {
+        if( is_etc1_file(path) ) {
+            etc1_texture_t texture = load_etc1_texture(path.c_str(), options);
+            entry->id = texture.color;
+            entry->alpha_id = texture.alpha;
+            entry->width = texture.width;
+            entry->height = texture.height;
+            entry->bytes = texture.bytes;
+        }
+        else if( is_raw_texture_file(path.c_str()) ) {
+            unsigned flags = 0;
+            entry->id = load_raw_texture(path.c_str(), options, &entry->width, &entry->height, &entry->bytes, &flags);
+            entry->premultiplied = flags & RAW_TEXTURE_PREMULTIPLIED;
+        }
+        else if( preloaded.valid() ) {
+            std::shared_ptr<image_t> image = preloaded.get();
+            entry->id = create_texture(image->pixels, image->width, image->height, image->format, options, &entry->bytes);
+            entry->width = image->width;
+            entry->height = image->height;
+        }
+        else entry->id = load_png_as_texture(path.c_str(), options, &entry->width, &entry->height, &entry->bytes);
+    } catch( ... ) {
+        delete entry;
+        throw;
+    }
+    entry->refs = 0;
+    entry->last_used = ticks;
+
+    entries[name] = entry;
+    used += entry->bytes;
+
+    /* Hold the new texture while making room for it */
+    Handle handle(this, entry);
+    evict();
+    if( budget != 0 && used > budget )
+        printf("Texture budget exceeded: %zu KB in use, %zu KB allowed\n", used / 1024, budget / 1024);
+
+    return handle;
+}
+
+/* The last handle is gone, texture becomes a candidate for eviction */
+void TextureManager::release(entry_t* entry) {
+    entry->refs -= 1;
+    if( entry->refs == 0 ) entry->last_used = ++ticks;
+}
+
+/* Delete least recently used textures nobody holds until we fit into the budget */
+void TextureManager::evict() {
+    while( budget != 0 && used > budget ) {
+        auto oldest = entries.end();
+        for( auto it = entries.begin(); it != entries.end(); ++it ) {
+            if( it->second->refs > 0 ) continue;
+            if( oldest == entries.end() || it->second->last_used < oldest->second->last_used ) oldest = it;
+        }
+        if( oldest == entries.end() ) return;
+
+        glDeleteTextures(1, &oldest->second->id);
+        if( oldest->second->alpha_id != 0 ) glDeleteTextures(1, &oldest->second->alpha_id);
+        used -= oldest->second->bytes;
+        delete oldest->second;
+        entries.erase(oldest);
+    }
+}
+
+void TextureManager::setBudget(size_t bytes) {
+    budget = bytes;
+    evict();
+}
+
+void TextureManager::purge() {
+    for( auto it = entries.begin(); it != entries.end(); ) {
+        if( it->second->refs > 0 ) {
+            ++it;
+            continue;
+        }
+
+        glDeleteTextures(1, &it->second->id);
+        if( it->second->alpha_id != 0 ) glDeleteTextures(1, &it->second->alpha_id);
+        used -= it->second->bytes;
+        delete it->second;
+        it = entries.erase(it);
+    }
+}
+
+/* Manager shared by all widgets of the process */
+TextureManager& TextureManager::shared() {
+    static TextureManager manager;
+    return manager;
+}
+
+TextureManager::Handle::Handle(TextureManager* owner, entry_t* shared) {
+    manager = owner;
+    entry = shared;
+    entry->refs += 1;
+}
+
+TextureManager::Handle::Handle(const Handle& other) {
+    manager = other.manager;
+    entry = other.entry;
+    if( entry != NULL ) entry->refs += 1;
+}
+
+TextureManager::Handle& TextureManager::Handle::operator=(const Handle& other) {
+    if( other.entry != NULL ) other.entry->refs += 1;
+    reset();
+
+    manager = other.manager;
+    entry = other.entry;
+    return *this;
+}
+
+void TextureManager::Handle::reset() {
+    if( entry != NULL ) manager->release(entry);
+    manager = NULL;
+    entry = NULL;
+}
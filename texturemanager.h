@@ -0,0 +1,119 @@
+#ifndef __TEXTUREMANAGER_H__
+#define __TEXTUREMANAGER_H__
+
+#include <GLES2/gl2.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "pngloader.h"
+#include "etc1loader.h"
+
+/* Textures loaded from PNG-files, ETC1 files (.ktx, .pkm) or raw textures (.tex), shared by all widgets drawing in one EGL context.
+   A texture is keyed by file path and storage options, so an image used by several widgets
+   is decoded and uploaded once. Textures nobody holds a handle of stay cached until the GPU memory
+   budget is exceeded, then the least recently used ones are deleted.
+
+   Budget is unlimited unless set with setBudget() or EGLWIDGET_TEXTURE_BUDGET (megabytes).
+   Except for preload(), call it from the thread owning the GL context only. Uploads and deletions bypass
+   GLState, which is reset after prepare(); reset it yourself when acquiring textures later */
+class TextureManager {
+private:
+    typedef struct {
+        GLuint id;
+        /* Alpha plane of ETC1 textures, 0 if none */
+        GLuint alpha_id;
+        /* Colour is premultiplied by alpha */
+        bool premultiplied;
+        size_t width;
+        size_t height;
+        /* GPU memory, mipmaps included */
+        size_t bytes;
+        /* Handles held */
+        int refs;
+        /* Value of 'ticks' when it was released last time */
+        uint64_t last_used;
+    } entry_t;
+
+    /* Image decoded by preload() and waiting for upload */
+    typedef struct image_t {
+        char* pixels;
+        size_t width;
+        size_t height;
+        GLenum format;
+        ~image_t() { free(pixels); }
+    } image_t;
+
+    std::unordered_map<std::string, entry_t*> entries;
+    size_t used;
+    size_t budget;
+    uint64_t ticks;
+
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<image_t> > > images;
+    std::mutex images_lock;
+
+    static std::string key(const std::string& path, const texture_options_t& options);
+    void release(entry_t* entry);
+    void evict();
+
+public:
+    /* Shared texture, released when the last copy of its handle is gone */
+    class Handle {
+        friend class TextureManager;
+
+    private:
+        TextureManager* manager;
+        entry_t* entry;
+
+        Handle(TextureManager* owner, entry_t* shared);
+
+    public:
+        Handle() { manager = NULL; entry = NULL; }
+        Handle(const Handle& other);
+        Handle& operator=(const Handle& other);
+        ~Handle() { reset(); }
+
+        /* Let the texture go, it stays cached while the budget allows */
+        void reset();
+
+        bool isValid() const { return entry != NULL; }
+        GLuint getId() const { return entry != NULL ? entry->id : 0; }
+        /* Texture holding alpha of a transparent ETC1 image in its colour channels, 0 otherwise */
+        GLuint getAlphaId() const { return entry != NULL ? entry->alpha_id : 0; }
+        /* Raw texture baked with premultiplied alpha, blend it with GL_ONE, GL_ONE_MINUS_SRC_ALPHA */
+        bool isPremultiplied() const { return entry != NULL && entry->premultiplied; }
+        size_t getWidth() const { return entry != NULL ? entry->width : 0; }
+        size_t getHeight() const { return entry != NULL ? entry->height : 0; }
+    };
+
+    TextureManager();
+    /* Textures aren't deleted: the GL context is usually gone by then */
+    ~TextureManager();
+
+    /* Decode PNG-file ahead of acquire(), e.g. in load() on a worker thread. May be called from any thread,
+       the file is decoded once no matter how many widgets preload it. ETC1 files and raw textures need no decoding */
+    void preload(const std::string& path);
+
+    /* Get texture of a file, uploading it unless it's cached already */
+    Handle acquire(const std::string& path, const texture_options_t& options);
+    Handle acquire(const std::string& path) { return acquire(path, default_texture_options); }
+
+    /* Limit GPU memory of cached textures, zero means no limit. Textures in use are never deleted,
+       so the limit may still be exceeded */
+    void setBudget(size_t bytes);
+    /* Delete all textures nobody uses */
+    void purge();
+
+    size_t getUsed() { return used; }
+    size_t getBudget() { return budget; }
+
+    /* Manager shared by all widgets of the process */
+    static TextureManager& shared();
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include <string.h>
 #include <stdio.h>
 #include "triangle.h"
+#include "shaders/triangle_vertex.h"
+#include "shaders/triangle_fragment.h"
 
 /* Z-axis rotation matrix */
 static void
@@ -58,59 +60,88 @@ const char* Triangle::fragmentShader() {
     return "shaders/triangle_fragment.shader";
 }
 
+/* Shader sources embedded at build time */
+const char* Triangle::vertexShaderSource() {
+    return triangle_vertex_shader;
+}
+
+const char* Triangle::fragmentShaderSource() {
+    return triangle_fragment_shader;
+}
+
+/* Triangle 2D-coordinates */
+static const GLfloat verts[][2] = {
+    { -1, -1 },
+    {  1, -1 },
+    {  0,  1 }
+};
+/* Vertex RGB-colors */
+static const GLfloat colors[][3] = {
+    { 1, 0, 0 },
+    { 0, 1, 0 },
+    { 0, 0, 1 }
+};
+
+/* Assign shader parameters before the shader program gets linked */
+void Triangle::bindAttributes() {
+    /* Pass 'pos' and 'color' parameters into our shader program */
+    bindAttribute(attr_pos, "pos");
+    bindAttribute(attr_color, "color");
+}
+
 /* Initialization before the main loop */
 void Triangle::prepare() {
-   /* Triangle 2D-coordinates */
-   static const GLfloat verts[][2] = {
-        { -1, -1 },
-        {  1, -1 },
-        {  0,  1 }
-    };
-    /* Vertex RGB-colors */
-    static const GLfloat colors[][3] = {
-        { 1, 0, 0 },
-        { 0, 1, 0 },
-        { 0, 0, 1 }
-    };
-
     /* Call parent */
     EGLWidget::prepare();
+}
 
-    /* Pass 'pos' and 'color' parameters into our shader program */
-    glBindAttribLocation(program, attr_pos, "pos");
-    glBindAttribLocation(program, attr_color, "color");
-    /* Link shader program */
-    glLinkProgram(program);
+/* Describe our vertex data */
+void Triangle::bind() {
+    /* Call parent */
+    EGLWidget::bind();
+
+    /* Vertex and color data are client-side arrays */
+    gl->bindBuffer(GL_ARRAY_BUFFER, 0);
 
     /* Describe our vertex and color data */
     glVertexAttribPointer(attr_pos, 2, GL_FLOAT, GL_FALSE, 0, verts);
     glVertexAttribPointer(attr_color, 3, GL_FLOAT, GL_FALSE, 0, colors);
 
     /* Enable attributes */
-    glEnableVertexAttribArray(attr_pos);
-    glEnableVertexAttribArray(attr_color);
+    gl->enableVertexAttribArray(attr_pos);
+    gl->enableVertexAttribArray(attr_color);
 }
 
 /* Draw one frame */
 void Triangle::draw() {
-    /* MVP, rotation and scaling matrices */
-    GLfloat mvp[16], rot[16], scale[16];
-
     /* Call parent */
     EGLWidget::draw();
 
-    /* Calculate MVP matrix */
-    make_z_rot_matrix(angle, rot);
-    make_scale_matrix(0.6, 0.6, 0.6, scale);
-    mul_matrix(mvp, rot, scale);
+    /* Take the latest state from update() */
+    state.fetch();
 
-    /* Pass it to our shader */
-    glUniformMatrix4fv(u_mvp, 1, GL_FALSE, mvp);
+    /* Pass MVP matrix to our shader */
+    gl->uniformMatrix4fv(u_mvp, state.front().mvp);
     /* Draw our trianlge */
     glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+/* Animate widget: redraw every frame */
+void Triangle::update() {
+    /* Rotation and scaling matrices */
+    GLfloat rot[16], scale[16];
 
     /* Rotate */
     angle += 5.0;
+
+    /* Calculate MVP matrix for draw() */
+    make_z_rot_matrix(angle, rot);
+    make_scale_matrix(0.6, 0.6, 0.6, scale);
+    mul_matrix(state.back().mvp, rot, scale);
+    state.publish();
+
+    /* Call parent */
+    EGLWidget::update();
 }
 
 /* Initialize widget */
@@ -121,6 +152,7 @@ Triangle::Triangle(): EGLWidget(100, 100, 400, 400) {
     attr_color = 1;
 }
 
+#ifndef EGLWIDGET_NO_MAIN
 int main(void) {
 #ifdef IS_RPI
     bcm_host_init();
@@ -132,3 +164,4 @@ int main(void) {
         fprintf(stderr, "Error: %s", ex.what());
     }
 }
+#endif
@@ -2,10 +2,18 @@
 #define __TRIANGLE_H__
 
 #include "widget.h"
+#include "triplebuffer.h"
 
 /* Rotating triangle widget */
 class Triangle: public EGLWidget {
 private:
+    /* State passed from update() to draw(), which may run on different threads */
+    typedef struct {
+        /* Model-view-projection matrix */
+        GLfloat mvp[16];
+    } state_t;
+    TripleBuffer<state_t> state;
+
     /* Rotation angle */
     GLfloat angle;
     /* Shader parameters */
@@ -13,10 +21,15 @@ private:
     GLint attr_color;
 public:
     Triangle();
+    virtual void bindAttributes();
     virtual void prepare();
+    virtual void bind();
+    virtual void update();
     virtual void draw();
     virtual const char* vertexShader();
     virtual const char* fragmentShader();
+    virtual const char* vertexShaderSource();
+    virtual const char* fragmentShaderSource();
 };
 
 #endif
@@ -0,0 +1,51 @@
+#ifndef __TRIPLEBUFFER_H__
+#define __TRIPLEBUFFER_H__
+
+#include <stdint.h>
+#include <atomic>
+
+/* Lock-free single producer, single consumer triple buffer.
+
+   Producer fills back(), then publish()-es it. Consumer calls fetch() to get the latest
+   published value into front(). Neither side ever waits: producer may publish faster than
+   consumer fetches, older values are simply dropped.
+
+   Slots are reused, so producer must write the whole value into back() every time */
+template<typename T>
+class TripleBuffer {
+private:
+    /* Slot index, plus a flag telling that middle slot has been published but not fetched yet */
+    static const uint8_t INDEX = 3;
+    static const uint8_t FRESH = 4;
+
+    T slots[3];
+
+    /* Producer's slot */
+    uint8_t back_index;
+    /* Slot exchanged between producer and consumer */
+    std::atomic<uint8_t> middle;
+    /* Consumer's slot */
+    uint8_t front_index;
+
+public:
+    TripleBuffer() : slots(), back_index(0), middle(1), front_index(2) {}
+
+    /* Producer side */
+    T& back() { return slots[back_index]; }
+
+    void publish() {
+        back_index = middle.exchange(back_index | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /* Consumer side. Returns true if front() has changed */
+    bool fetch() {
+        if( (middle.load(std::memory_order_relaxed) & FRESH) == 0 ) return false;
+
+        front_index = middle.exchange(front_index, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    const T& front() { return slots[front_index]; }
+};
+
+#endif
@@ -1,14 +1,24 @@
+#include <errno.h>
 #include <stdio.h>
-#include <sys/time.h>
-#include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "widget.h"
+#include "shadercache.h"
+#include "workers.h"
+#include "shaders/layer_vertex.h"
+#include "shaders/layer_fragment.h"
 
 /* Widget initialization */
 void EGLWidget::init() {
@@ -17,11 +27,39 @@ void EGLWidget::init() {
     width = 0;
     height = 0;
     frames = 0;
+    pacing = FramePacer::PACE_FIXED;
+    threaded = false;
+    updating = false;
+
+    memset(&startup, 0, sizeof(startup));
+    loading_time = 0;
+
+    dirty = true;
+    sleeping = false;
+
+    epoll_fd = -1;
+    timer_fd = -1;
+    wakeup_fd = -1;
+
+    host = NULL;
+    stats = NULL;
+    metrics = NULL;
 
     u_mvp = -1;
     u_frames = -1;
 
     program = 0;
+    gl = &state;
+    clear_mask = GL_COLOR_BUFFER_BIT;
+    render_scale = 1.0f;
+    cached = false;
+    drawing_layer = false;
+    memset(&layer_program, 0, sizeof(layer_program));
+
+    repaint.x = 0;
+    repaint.y = 0;
+    repaint.width = 0;
+    repaint.height = 0;
     display = EGL_NO_DISPLAY;
     context = EGL_NO_CONTEXT;
     surface = EGL_NO_SURFACE;
@@ -29,7 +67,23 @@ void EGLWidget::init() {
 
 /* Free resources */
 void EGLWidget::finish() {
+    closeLoop();
+
+    delete metrics;
+    metrics = NULL;
+
+    /* EGL resources belong to our host. Our layer lives in its context, unless that's gone already */
+    if( host != NULL ) {
+        if( eglGetCurrentContext() == context ) layer.destroy();
+        return;
+    }
+
     if( surface != EGL_NO_SURFACE ) {
+        layer.destroy();
+        offscreen.destroy();
+        Layer::destroyProgram(layer_program);
+
+        glDisable(GL_SCISSOR_TEST);
         glClear(GL_COLOR_BUFFER_BIT);
 
         eglSwapBuffers(display, surface);
@@ -46,42 +100,82 @@ void EGLWidget::finish() {
     }
 }
 
-/* Create widget surface */
-void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
-    printf("Creating surface\n");
-
-    /* Get default EGL display */
-#ifdef IS_RPI
-    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-#else
-    Display* xdisplay = XOpenDisplay(NULL);
-    if( ! xdisplay ) throw std::runtime_error("Cannot open X11 display");
+/* Memory cost of EGL config: bits per pixel of all its buffers */
+static EGLint config_cost(EGLDisplay display, EGLConfig config) {
+    EGLint buffer = 0, depth = 0, stencil = 0, samples = 0, caveat = EGL_NONE;
+    eglGetConfigAttrib(display, config, EGL_BUFFER_SIZE, &buffer);
+    eglGetConfigAttrib(display, config, EGL_DEPTH_SIZE, &depth);
+    eglGetConfigAttrib(display, config, EGL_STENCIL_SIZE, &stencil);
+    eglGetConfigAttrib(display, config, EGL_SAMPLES, &samples);
+    eglGetConfigAttrib(display, config, EGL_CONFIG_CAVEAT, &caveat);
 
-    display = eglGetDisplay(xdisplay);
-#endif
+    EGLint cost = (buffer + depth + stencil) * std::max(samples, 1);
 
-    if( display == EGL_NO_DISPLAY ) throw std::runtime_error("Cannot get display");
+    /* Slow configs are the last resort */
+    if( caveat == EGL_SLOW_CONFIG ) cost += 1 << 16;
+    return cost;
+}
 
+/* Initialize EGL display, choose framebuffer configuration and create context */
+EGLConfig EGLWidget::initContext(EGLint surface_type) {
     /* Initialize EGL display */
     int major, minor;
     EGLBoolean result = eglInitialize(display, &major, &minor);
     if( result == EGL_FALSE ) throw std::runtime_error("Cannot initialize display");
 
-    /* Framebuffer configuration: 8-bit color + alpha channel */
-    static const EGLint attribute_list[] = {
-        EGL_RED_SIZE, 8,
-        EGL_GREEN_SIZE, 8,
-        EGL_BLUE_SIZE, 8,
-        EGL_ALPHA_SIZE, 8,
-        EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
+    /* Framebuffer configuration requested by the widget */
+    framebuffer_t wanted = framebuffer();
+    const EGLint attribute_list[] = {
+        EGL_RED_SIZE, wanted.red,
+        EGL_GREEN_SIZE, wanted.green,
+        EGL_BLUE_SIZE, wanted.blue,
+        EGL_ALPHA_SIZE, wanted.alpha,
+        EGL_DEPTH_SIZE, wanted.depth,
+        EGL_STENCIL_SIZE, wanted.stencil,
+        EGL_SAMPLE_BUFFERS, wanted.samples > 0 ? 1 : 0,
+        EGL_SAMPLES, wanted.samples,
+        EGL_SURFACE_TYPE, surface_type,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
         EGL_NONE
     };
-    EGLConfig config;
-    EGLint num_config;
+    EGLint num_config = 0;
+
+    /* Get all matching configs. EGL sorts them deepest color first, which is the most expensive one */
+    result = eglChooseConfig(display, attribute_list, NULL, 0, &num_config);
+    if( result == EGL_FALSE || num_config < 1 ) throw std::runtime_error("Cannot choose config");
+
+    std::vector<EGLConfig> configs(num_config);
+    result = eglChooseConfig(display, attribute_list, &configs[0], num_config, &num_config);
+    if( result == EGL_FALSE || num_config < 1 ) throw std::runtime_error("Cannot choose config");
+
+    /* Take the cheapest one */
+    EGLConfig config = configs[0];
+    EGLint best = config_cost(display, config);
+    for( EGLint i = 1; i < num_config; ++i ) {
+        EGLint cost = config_cost(display, configs[i]);
+        if( cost < best ) {
+            best = cost;
+            config = configs[i];
+        }
+    }
+
+    /* Don't clear buffers we haven't got */
+    EGLint depth = 0, stencil = 0;
+    eglGetConfigAttrib(display, config, EGL_DEPTH_SIZE, &depth);
+    eglGetConfigAttrib(display, config, EGL_STENCIL_SIZE, &stencil);
+
+    clear_mask = GL_COLOR_BUFFER_BIT;
+    if( depth > 0 ) clear_mask |= GL_DEPTH_BUFFER_BIT;
+    if( stencil > 0 ) clear_mask |= GL_STENCIL_BUFFER_BIT;
 
-    /* Set configuration */
-    result = eglChooseConfig(display, attribute_list, &config, 1, &num_config);
-    if( result == EGL_FALSE ) throw std::runtime_error("Cannot choose config");
+    EGLint red = 0, green = 0, blue = 0, alpha = 0, samples = 0;
+    eglGetConfigAttrib(display, config, EGL_RED_SIZE, &red);
+    eglGetConfigAttrib(display, config, EGL_GREEN_SIZE, &green);
+    eglGetConfigAttrib(display, config, EGL_BLUE_SIZE, &blue);
+    eglGetConfigAttrib(display, config, EGL_ALPHA_SIZE, &alpha);
+    eglGetConfigAttrib(display, config, EGL_SAMPLES, &samples);
+    printf("EGL config: R%dG%dB%dA%d, depth %d, stencil %d, samples %d (cheapest of %d)\n",
+           red, green, blue, alpha, depth, stencil, samples, num_config);
 
     /* Choose EGL API */
     result = eglBindAPI(EGL_OPENGL_ES_API);
@@ -96,6 +190,84 @@ void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
     context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
     if( context == EGL_NO_CONTEXT ) throw std::runtime_error("Cannot create context");
 
+    return config;
+}
+
+/* Is headless backend selected at build time or with EGLWIDGET_BACKEND=headless */
+static bool is_headless() {
+    const char* backend = getenv("EGLWIDGET_BACKEND");
+    if( backend != NULL ) return strcmp(backend, "headless") == 0;
+
+#ifdef EGLWIDGET_HEADLESS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* Create offscreen widget surface. Doesn't need any display server */
+void EGLWidget::createHeadlessSurface(int sx, int sy, int sw, int sh) {
+    printf("Creating headless surface\n");
+
+    /* Prefer Mesa's surfaceless platform, it works without X11, Wayland or DRM master */
+    const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if( extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL ) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if( getPlatformDisplay != NULL )
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+
+    /* Otherwise use default display with a pbuffer surface */
+    if( display == EGL_NO_DISPLAY ) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if( display == EGL_NO_DISPLAY ) throw std::runtime_error("Cannot get display");
+
+    EGLConfig config = initContext(EGL_PBUFFER_BIT);
+
+    /* Offscreen surface of the widget's size */
+    const EGLint pbuffer_attributes[] = {
+        EGL_WIDTH, sw,
+        EGL_HEIGHT, sh,
+        EGL_NONE
+    };
+
+    surface = eglCreatePbufferSurface(display, config, pbuffer_attributes);
+    if( surface == EGL_NO_SURFACE ) throw std::runtime_error("Cannot create pbuffer surface");
+
+    EGLBoolean result = eglMakeCurrent(display, surface, surface, context);
+    if( result == EGL_FALSE ) throw std::runtime_error("Cannot connect context to surface");
+
+    x = sx;
+    y = sy;
+    width = sw;
+    height = sh;
+}
+
+/* Create widget surface */
+void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
+    if( is_headless() ) {
+        createHeadlessSurface(sx, sy, sw, sh);
+        return;
+    }
+
+    printf("Creating surface\n");
+
+    /* Get default EGL display */
+#ifdef IS_RPI
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+#else
+    Display* xdisplay = XOpenDisplay(NULL);
+    if( ! xdisplay ) throw std::runtime_error("Cannot open X11 display");
+
+    display = eglGetDisplay(xdisplay);
+#endif
+
+    if( display == EGL_NO_DISPLAY ) throw std::runtime_error("Cannot get display");
+
+    /* Initialize display, create context */
+    EGLConfig config = initContext(EGL_WINDOW_BIT);
+    EGLBoolean result;
+
 #ifdef IS_RPI
     /* Raspberry PI specific initialization */
     /* Get screen size */
@@ -112,10 +284,14 @@ void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
 
     VC_RECT_T src_rect;
 
+    /* Reduced resolution: DispmanX hardware scaler stretches the smaller surface */
+    uint32_t surface_width = scaled(width);
+    uint32_t surface_height = scaled(height);
+
     src_rect.x = 0;
     src_rect.y = 0;
-    src_rect.width  = width << 16;
-    src_rect.height = height << 16;
+    src_rect.width  = surface_width << 16;
+    src_rect.height = surface_height << 16;
 
     /* Create window descriptor */
     DISPMANX_DISPLAY_HANDLE_T dispman_display = vc_dispmanx_display_open( 0 /* LCD */);
@@ -131,8 +307,8 @@ void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
                                 0  /*alpha*/, 0 /*clamp*/, DISPMANX_NO_ROTATE /*transform*/);
 
     nativeWindow.element = dispman_element;
-    nativeWindow.width = width;
-    nativeWindow.height = height;
+    nativeWindow.width = surface_width;
+    nativeWindow.height = surface_height;
 
     vc_dispmanx_update_submit_sync( dispman_update );
 #else
@@ -141,9 +317,22 @@ void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
     width = sw;
     height = sh;
 
-    /* We want 32-bit color mode */
+    /* Window visual has to match the chosen config, e.g. 32-bit for a transparent window */
     XVisualInfo vinfo;
-    XMatchVisualInfo(xdisplay, DefaultScreen(xdisplay), 32, TrueColor, &vinfo);
+    EGLint visual_id = 0;
+    eglGetConfigAttrib(display, config, EGL_NATIVE_VISUAL_ID, &visual_id);
+
+    XVisualInfo vtemplate;
+    vtemplate.visualid = visual_id;
+    int num_visuals = 0;
+    XVisualInfo* visuals = XGetVisualInfo(xdisplay, VisualIDMask, &vtemplate, &num_visuals);
+    if( visuals != NULL && num_visuals > 0 ) {
+        vinfo = visuals[0];
+    }
+    else {
+        XMatchVisualInfo(xdisplay, DefaultScreen(xdisplay), 32, TrueColor, &vinfo);
+    }
+    if( visuals != NULL ) XFree(visuals);
 
     /* Create a transparent borderless window */
     XSetWindowAttributes attr;
@@ -212,6 +401,122 @@ void EGLWidget::createSurface(int sx, int sy, int sw, int sh) {
     y = sy;
 }
 
+/* Share the surface of a hosting widget instead of creating our own.
+   Coordinates become relative to the host's surface */
+void EGLWidget::attach(EGLWidget* to) {
+    host = to;
+
+    display = to->display;
+    context = to->context;
+    surface = to->surface;
+    gl = to->gl;
+    clear_mask = to->clear_mask;
+}
+
+/* Set viewport to the widget's area and scissor to the part of it being repainted */
+void EGLWidget::setViewport() {
+    /* Layer holds just this widget */
+    if( drawing_layer ) {
+        gl->viewport(0, 0, layer.getWidth(), layer.getHeight());
+        gl->disable(GL_SCISSOR_TEST);
+        return;
+    }
+
+    if( host == NULL ) {
+        gl->viewport(0, 0, scaled(width), scaled(height));
+        setScissor(repaint);
+        return;
+    }
+
+    /* GL window coordinates start at the bottom left corner of the host's surface.
+       Scissor keeps glClear() within our area */
+    GLint vx = scaled(x), vy = scaled(y);
+    GLint vw = scaled(x + width) - vx, vh = scaled(y + height) - vy;
+    gl->viewport(vx, scaled(host->height) - vy - vh, vw, vh);
+
+    Damage::rect_t area = { (int) x, (int) y, (int) width, (int) height };
+    setScissor(Damage::intersect(area, host->repaint));
+}
+
+/* Clip drawing to the given area of the surface. Whole surface needs no scissor test */
+void EGLWidget::setScissor(const Damage::rect_t& area) {
+    EGLWidget* owner = host != NULL ? host : this;
+
+    if( area.x <= 0 && area.y <= 0 && area.x + area.width >= (int) owner->width &&
+        area.y + area.height >= (int) owner->height ) {
+        gl->disable(GL_SCISSOR_TEST);
+        return;
+    }
+
+    /* Area is given in surface coordinates, drawing may be done at a reduced resolution */
+    GLint x0 = scaled(area.x), y0 = scaled(area.y);
+    GLint x1 = scaled(area.x + std::max(area.width, 0)), y1 = scaled(area.y + std::max(area.height, 0));
+    gl->scissor(x0, scaled(owner->height) - y1, x1 - x0, y1 - y0);
+    gl->enable(GL_SCISSOR_TEST);
+}
+
+/* Convert surface coordinate to drawing resolution */
+int EGLWidget::scaled(int value) {
+    float scale = host != NULL ? host->render_scale : render_scale;
+    return (int) floorf(value * scale + 0.5f);
+}
+
+/* Choose drawing resolution */
+void EGLWidget::setRenderScale(float scale) {
+    render_scale = std::min(std::max(scale, 0.1f), 1.0f);
+}
+
+/* Size of the widget's viewport at the drawing resolution */
+int EGLWidget::viewportWidth() {
+    return host != NULL ? scaled(x + width) - scaled(x) : scaled(width);
+}
+
+int EGLWidget::viewportHeight() {
+    return host != NULL ? scaled(y + height) - scaled(y) : scaled(height);
+}
+
+/* Compile program which draws layers */
+void EGLWidget::createLayerProgram() {
+    if( layer_program.program != 0 ) return;
+
+    GLuint vert_shader = compileShader(GL_VERTEX_SHADER, "layer vertex shader", layer_vertex_shader);
+    GLuint frag_shader = compileShader(GL_FRAGMENT_SHADER, "layer fragment shader", layer_fragment_shader);
+    layer_program = Layer::createProgram(vert_shader, frag_shader);
+}
+
+/* Program drawing layers of our GL context, hosted widgets use their host's one */
+const Layer::program_t& EGLWidget::layerProgram() {
+    EGLWidget* owner = host != NULL ? host : this;
+    owner->createLayerProgram();
+    return owner->layer_program;
+}
+
+/* Layer which draw() currently draws into, NULL for the surface */
+Layer* EGLWidget::drawTarget() {
+    if( drawing_layer ) return &layer;
+
+    EGLWidget* owner = host != NULL ? host : this;
+    return owner->offscreen.isEnabled() ? &owner->offscreen : NULL;
+}
+
+/* Create layer caching the whole widget. It needs alpha channel to be blended by a compositor */
+void EGLWidget::createLayer() {
+    layerProgram();
+    layer.init(viewportWidth(), viewportHeight(), clear_mask, false);
+}
+
+/* Create offscreen framebuffer of the reduced size */
+void EGLWidget::createOffscreen() {
+    createLayerProgram();
+
+    /* 16-bit widgets don't need a deeper offscreen buffer */
+    framebuffer_t fb = framebuffer();
+    bool rgb565 = fb.red <= 5 && fb.green <= 6 && fb.blue <= 5 && fb.alpha == 0;
+
+    offscreen.init(scaled(width), scaled(height), clear_mask, rgb565);
+    printf("Render scale %.2f: drawing %dx%d, upscaled to %dx%d\n", render_scale, scaled(width), scaled(height), width, height);
+}
+
 /* Load text file as a string */
 std::string EGLWidget::loadFile(const char* file) {
     std::ifstream is(file);
@@ -223,16 +528,27 @@ std::string EGLWidget::loadFile(const char* file) {
     return shader;
 }
 
-/* Compile shader programe from the given file */
-GLuint EGLWidget::compileShader(GLenum type, const char* file) {
-    printf("Compiling shader file: %s\n", file);
+/* Shader source embedded at build time, or loaded from file if there's none
+   or EGLWIDGET_SHADER_FILES is set */
+std::string EGLWidget::shaderSource(const char* file, const char* source) {
+    const char* files = getenv("EGLWIDGET_SHADER_FILES");
+    bool prefer_files = files != NULL && *files != '\0' && strcmp(files, "0") != 0;
+
+    if( source != NULL && (file == NULL || !prefer_files) ) return source;
+    if( file == NULL ) throw std::runtime_error("Widget has no shader source");
+
+    return loadFile(file);
+}
+
+/* Compile shader programe from the given source. 'name' is used in error messages */
+GLuint EGLWidget::compileShader(GLenum type, const char* name, const std::string& data) {
+    printf("Compiling shader: %s\n", name);
 
     /* Create either vertex or pixel shader */
     GLuint shader = glCreateShader(type);
-    if( !shader ) throw std::runtime_error(std::string("Cannot create shader for file: ") + file);
+    if( !shader ) throw std::runtime_error(std::string("Cannot create shader: ") + name);
 
-    /* Load shader code */
-    std::string data = loadFile(file);
+    /* Shader code */
     const char* source[1] = { data.c_str() };
 
     /* Compile shader code */
@@ -248,7 +564,7 @@ GLuint EGLWidget::compileShader(GLenum type, const char* file) {
         glGetShaderInfoLog(shader, sizeof(log), &len, log);
         glDeleteShader(shader);
         /* Throw exception with error description */
-        throw std::runtime_error(std::string("Cannot compile shader from file: ") + file + ":\n" + log);
+        throw std::runtime_error(std::string("Cannot compile shader: ") + name + ":\n" + log);
     }
 
     /* Return compiled shader descriptor */
@@ -257,55 +573,174 @@ GLuint EGLWidget::compileShader(GLenum type, const char* file) {
 
 /* Load vertex and pixel shaders */
 void EGLWidget::loadShaders() {
+    /* Widget doesn't draw anything by itself */
+    if( vertexShaderSource() == NULL && vertexShader() == NULL ) return;
+
     printf("Loading shaders\n");
 
-    /* Compile shaders. Child class must provide us with path to shader files */ 
-    GLuint fragShader = compileShader(GL_FRAGMENT_SHADER, fragmentShader());
-    GLuint vertShader = compileShader(GL_VERTEX_SHADER, vertexShader());
+    /* Child class must provide us with shader sources or paths to shader files */
+    std::string fragSource = shaderSource(fragmentShader(), fragmentShaderSource());
+    std::string vertSource = shaderSource(vertexShader(), vertexShaderSource());
+
+    /* Shader names for error messages */
+    const char* fragName = fragmentShader() ? fragmentShader() : "embedded fragment shader";
+    const char* vertName = vertexShader() ? vertexShader() : "embedded vertex shader";
 
-    /* Create shader program */
+    /* Linked program may be cached from the previous run. Attribute bindings are linked into it,
+       so the widget makes them first and they are part of the cache key */
+    ShaderCache cache;
     program = glCreateProgram();
     if( program == 0 ) throw std::runtime_error("Cannot create program");
-
-    /* Link program with pixel and vertex shaders */
-    glAttachShader(program, fragShader);
-    glAttachShader(program, vertShader);
-    glLinkProgram(program);
-
-    /* Dont forget to check for errors */
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if( !status ) {
-      char log[1024];
-      GLsizei len;
-      glGetProgramInfoLog(program, sizeof(log), &len, log);
-      throw std::runtime_error(std::string("Cannot link program:\n") + log);
+    attributes.clear();
+    bindAttributes();
+
+    if( ! cache.load(program, vertSource, fragSource, attributes) ) {
+        /* Driver may have refused the binary, start over with a clean program */
+        glDeleteProgram(program);
+        program = glCreateProgram();
+        if( program == 0 ) throw std::runtime_error("Cannot create program");
+        attributes.clear();
+        bindAttributes();
+
+        /* Compile shaders */
+        GLuint fragShader = compileShader(GL_FRAGMENT_SHADER, fragName, fragSource);
+        GLuint vertShader = compileShader(GL_VERTEX_SHADER, vertName, vertSource);
+
+        /* Link program with pixel and vertex shaders */
+        glAttachShader(program, fragShader);
+        glAttachShader(program, vertShader);
+        glLinkProgram(program);
+
+        /* Dont forget to check for errors */
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if( !status ) {
+          char log[1024];
+          GLsizei len;
+          glGetProgramInfoLog(program, sizeof(log), &len, log);
+          throw std::runtime_error(std::string("Cannot link program:\n") + log);
+        }
+
+        /* Free resources */
+        glDeleteShader(fragShader);
+        glDeleteShader(vertShader);
+
+        /* Save program binary for the next run */
+        cache.store(program, vertSource, fragSource, attributes);
     }
 
     /* Tell EGL to use our shader program */
-    glUseProgram(program);
+    gl->useProgram(program);
 
     /* Get 'mvp' and 'frames' shader descriptors */
     u_mvp = glGetUniformLocation(program, "mvp");
     u_frames = glGetUniformLocation(program, "frames");
+}
+
+/* Virtual function called on a worker thread to load widget's files */
+void EGLWidget::load() {
+}
 
-    /* Free resources */
-    glDeleteShader(fragShader);
-    glDeleteShader(vertShader);
+/* Virtual function called before linking shader program */
+void EGLWidget::bindAttributes() {
+}
+
+/* Bind attribute location and remember the binding for the shader cache key */
+void EGLWidget::bindAttribute(GLuint index, const char* name) {
+    glBindAttribLocation(program, index, name);
+
+    attribute_binding_t binding;
+    binding.index = index;
+    binding.name = name;
+    attributes.push_back(binding);
+}
+
+/* Start drawing into the layer unless it's still valid */
+bool EGLWidget::beginLayer(Layer& target) {
+    if( target.getWidth() != viewportWidth() || target.getHeight() != viewportHeight() ) {
+        target.init(viewportWidth(), viewportHeight(), clear_mask, false);
+
+        /* Texture and framebuffer were bound bypassing the tracker */
+        gl->reset();
+        bind();
+    }
+    if( target.isValid() ) return false;
+
+    target.begin(gl);
+    gl->disable(GL_SCISSOR_TEST);
+
+    /* Layer is blended as premultiplied alpha, so it starts transparent whatever the widget clears to */
+    GLfloat color[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, color);
+    glClearColor(0, 0, 0, 0);
+    glClear(clear_mask);
+    glClearColor(color[0], color[1], color[2], color[3]);
+    return true;
+}
+
+/* Continue drawing where beginLayer() has left */
+void EGLWidget::endLayer(Layer& target) {
+    target.end(drawTarget());
+    setViewport();
+}
+
+/* Draw layer texture over the widget */
+void EGLWidget::drawLayer(Layer& target) {
+    gl->enable(GL_BLEND);
+    gl->blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    target.draw(gl, layerProgram());
+
+    gl->disable(GL_BLEND);
+    bind();
+}
+
+/* Draw standalone widget through its layer, which is redrawn only when the widget has changed */
+void EGLWidget::drawCached(bool changed) {
+    if( changed || ! layer.isValid() ) {
+        drawing_layer = true;
+        layer.begin(gl);
+        bind();
+        draw();
+        drawing_layer = false;
+        layer.end(drawTarget());
+    }
+
+    /* Layer holds the whole widget, alpha channel included */
+    setViewport();
+    gl->disable(GL_BLEND);
+    layer.draw(gl, layerProgram());
 }
 
 /* Virtual function called before entering the main loop */
 void EGLWidget::prepare() {
     /* Set viewport size */
-    glViewport (0, 0, width, height);
+    setViewport();
+}
+
+/* Virtual function called to restore widget's GL state before drawing */
+void EGLWidget::bind() {
+    gl->useProgram(program);
+    setViewport();
 }
 
 /* Virtual function called to draw one frame */
 void EGLWidget::draw() {
     /* Clear surface */
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glClear(clear_mask);
     /* Pass frames counter to shader program */
-    glUniform1f(u_frames, frames);
+    gl->uniform1f(u_frames, frames);
+}
+
+/* Virtual function called when the widget wakes up */
+void EGLWidget::update() {
+    /* By default widget is animated: redraw every frame */
+    invalidate();
+}
+
+/* Virtual function returns time of the next update */
+uint64_t EGLWidget::nextWakeup(uint64_t now) {
+    /* As soon as possible, pacer limits the actual rate */
+    return now;
 }
 
 /* Virtual function returns path to vertex shader file */
@@ -317,35 +752,462 @@ const char* EGLWidget::fragmentShader() {
     return "fragment.shader";
 }
 
+/* Virtual function returns vertex shader source. NULL means load it from file */
+const char* EGLWidget::vertexShaderSource() {
+    return NULL;
+}
+/* Virtual function returns pixel shader source. NULL means load it from file */
+const char* EGLWidget::fragmentShaderSource() {
+    return NULL;
+}
+
+/* Virtual function called to get framebuffer requirements: 8-bit color and alpha channel */
+EGLWidget::framebuffer_t EGLWidget::framebuffer() {
+    framebuffer_t fb = { 8, 8, 8, 8, 0, 0, 0 };
+    return fb;
+}
+
+/* Request a redraw */
+void EGLWidget::invalidate() {
+    damage(0, 0, width, height);
+}
+
+/* Request a redraw of the given area */
+void EGLWidget::damage(int dx, int dy, int dw, int dh) {
+    /* Hosted widget is drawn by its host's main loop */
+    if( host != NULL ) {
+        /* Keep damage within our area and the host's surface. Damage which can't be seen doesn't
+           make us dirty: the host would never draw us and keep waking up to update us */
+        int x0 = std::max(dx, 0), y0 = std::max(dy, 0);
+        int x1 = std::min(std::min(dx + dw, (int) width), (int) host->width - (int) x);
+        int y1 = std::min(std::min(dy + dh, (int) height), (int) host->height - (int) y);
+        if( x1 > x0 && y1 > y0 ) {
+            dirty = true;
+            host->damage(x + x0, y + y0, x1 - x0, y1 - y0);
+        }
+        return;
+    }
+
+    dirty = true;
+
+    /* Reduced resolution frames are always drawn completely */
+    if( render_scale != 1.0f || (dx <= 0 && dy <= 0 && dx + dw >= (int) width && dy + dh >= (int) height) ) {
+        damaged.addFull();
+    }
+    else {
+        Damage::rect_t r = { dx, dy, dw, dh };
+        damaged.add(r);
+    }
+
+    requestRedraw();
+}
+
+/* Wake up the main loop to draw a frame */
+void EGLWidget::requestRedraw() {
+    dirty = true;
+
+    /* Wake up the main loop if it's waiting for a timer */
+    if( sleeping ) {
+        uint64_t one = 1;
+        if( write(wakeup_fd, &one, sizeof(one)) < 0 ) perror("Cannot wake up main loop");
+    }
+}
+
+/* Create main loop descriptors */
+void EGLWidget::openLoop() {
+    /* Timer which fires at absolute CLOCK_MONOTONIC time */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if( timer_fd < 0 ) throw std::runtime_error("Cannot create timer");
+
+    /* Event which is signalled by invalidate() */
+    wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if( wakeup_fd < 0 ) throw std::runtime_error("Cannot create wakeup event");
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if( epoll_fd < 0 ) throw std::runtime_error("Cannot create epoll");
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+
+    ev.data.fd = timer_fd;
+    if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0 ) throw std::runtime_error("Cannot watch timer");
+
+    ev.data.fd = wakeup_fd;
+    if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &ev) < 0 ) throw std::runtime_error("Cannot watch wakeup event");
+
+    /* Metrics clients are served while we sleep, and on every loop iteration otherwise */
+    if( metrics != NULL ) {
+        ev.data.fd = metrics->getSocket();
+        if( epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0 ) throw std::runtime_error("Cannot watch metrics socket");
+    }
+}
+
+/* Close main loop descriptors */
+void EGLWidget::closeLoop() {
+    if( epoll_fd >= 0 ) close(epoll_fd);
+    if( timer_fd >= 0 ) close(timer_fd);
+    if( wakeup_fd >= 0 ) close(wakeup_fd);
+
+    epoll_fd = timer_fd = wakeup_fd = -1;
+}
+
+/* Sleep until given CLOCK_MONOTONIC time or until invalidate() is called. Time 0 waits for invalidate() only */
+void EGLWidget::sleepUntil(uint64_t time) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = time / 1000000000ULL;
+    its.it_value.tv_nsec = time % 1000000000ULL;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+
+    /* Don't sleep if a redraw has been requested meanwhile */
+    sleeping = true;
+    if( ! dirty ) {
+        struct epoll_event events[3];
+        int n = epoll_wait(epoll_fd, events, 3, -1);
+
+        /* Drain whatever woke us up */
+        for( int i = 0; i < n; ++i ) {
+            if( metrics != NULL && events[i].data.fd == metrics->getSocket() ) {
+                metrics->serve();
+                continue;
+            }
+
+            uint64_t value;
+            if( read(events[i].data.fd, &value, sizeof(value)) < 0 && errno != EAGAIN )
+                perror("Cannot read main loop event");
+        }
+    }
+    sleeping = false;
+}
+
+/* Update thread of the threaded mode: calls update() when the widget wants it, paced by 'pacer'.
+   Drawing is requested with invalidate() as usual */
+void EGLWidget::updateLoop(FramePacer* pacer) {
+    try {
+        while( updating ) {
+            /* Don't run ahead of drawing: wait until the previous update is being drawn */
+            if( dirty ) {
+                std::unique_lock<std::mutex> lock(update_mutex);
+                update_cond.wait(lock, [this] { return ! dirty || ! updating; });
+                continue;
+            }
+
+            uint64_t now = FramePacer::now();
+
+            /* Benchmark measures the cost of a full frame, update as fast as possible */
+            uint64_t due = stats != NULL ? now : nextWakeup(now);
+            if( due < pacer->getDeadline() ) due = pacer->getDeadline();
+
+            if( due > now ) {
+                /* libstdc++ steady_clock is CLOCK_MONOTONIC, same as FramePacer::now() */
+                std::unique_lock<std::mutex> lock(update_mutex);
+                if( updating )
+                    update_cond.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(due)));
+                continue;
+            }
+
+            pacer->resume(now);
+            update();
+            recordPhase(FrameStats::PHASE_UPDATE, now);
+            pacer->frameDone();
+
+            if( metrics != NULL ) metrics->overruns = pacer->getMissed();
+        }
+    } catch( ... ) {
+        /* Rethrown by the main loop */
+        update_error = std::current_exception();
+        updating = false;
+        invalidate();
+    }
+}
+
+/* Start update thread */
+void EGLWidget::startUpdates(FramePacer* pacer) {
+    updating = true;
+    updater = std::thread(&EGLWidget::updateLoop, this, pacer);
+}
+
+/* Let update thread prepare the next frame, called when a redraw request is taken */
+void EGLWidget::resumeUpdates() {
+    /* Taking the lock makes sure the update thread is either waiting or sees 'dirty' cleared */
+    {
+        std::lock_guard<std::mutex> lock(update_mutex);
+    }
+    update_cond.notify_one();
+}
+
+/* Stop update thread */
+void EGLWidget::stopUpdates() {
+    {
+        std::lock_guard<std::mutex> lock(update_mutex);
+        updating = false;
+    }
+    update_cond.notify_one();
+    updater.join();
+}
+
+/* Submit widget's load() to the worker pool */
+void EGLWidget::startLoading(std::vector<std::future<void> >& tasks) {
+    EGLWidget* owner = host != NULL ? host : this;
+
+    tasks.push_back(WorkerPool::shared().submit([this, owner] {
+        uint64_t start = FramePacer::now();
+        load();
+        owner->loading_time += FramePacer::now() - start;
+    }));
+}
+
+/* Print how long each startup phase took */
+void EGLWidget::reportStartup(uint64_t first_frame) {
+    printf("Startup: surface %.1f ms, shaders %.1f ms, waiting for files %.1f ms (loading took %.1f ms, %u workers), "
+           "prepare %.1f ms, first frame %.1f ms, total %.1f ms\n",
+           (startup.surface - startup.start) / 1e6,
+           (startup.shaders - startup.surface) / 1e6,
+           (startup.assets - startup.shaders) / 1e6,
+           loading_time / 1e6, WorkerPool::shared().size(),
+           (startup.prepared - startup.assets) / 1e6,
+           (first_frame - startup.prepared) / 1e6,
+           (first_frame - startup.start) / 1e6);
+}
+
+/* Record duration of a frame phase which started at 'start' */
+void EGLWidget::recordPhase(FrameStats::phase_t phase, uint64_t start) {
+    /* Hosted widgets are measured by their host */
+    EGLWidget* owner = host != NULL ? host : this;
+    if( owner->stats == NULL && owner->metrics == NULL ) return;
+
+    uint64_t duration = FramePacer::now() - start;
+    if( owner->stats != NULL ) owner->stats->add(phase, duration);
+    if( owner->metrics != NULL ) owner->metrics->record(phase, duration);
+}
+
+/* Save current frame as binary PPM-file <prefix><index>.ppm */
+void EGLWidget::dumpFrame(const char* prefix, unsigned long index) {
+    std::vector<unsigned char> pixels(width * height * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s%06lu.ppm", prefix, index);
+
+    FILE* fp = fopen(path, "wb");
+    if( fp == NULL ) throw std::runtime_error(std::string("Cannot create frame dump: ") + path);
+
+    fprintf(fp, "P6\n%u %u\n255\n", width, height);
+
+    /* GL rows go bottom to top, PPM rows go top to bottom. Alpha is dropped */
+    std::vector<unsigned char> row(width * 3);
+    for( int r = height - 1; r >= 0; --r ) {
+        const unsigned char* src = &pixels[r * width * 4];
+        for( uint32_t c = 0; c < width; ++c ) {
+            row[c * 3 + 0] = src[c * 4 + 0];
+            row[c * 3 + 1] = src[c * 4 + 1];
+            row[c * 3 + 2] = src[c * 4 + 2];
+        }
+        fwrite(&row[0], 1, row.size(), fp);
+    }
+
+    fclose(fp);
+}
+
 /* Main loop */
 void EGLWidget::run(int fps) {
+    /* Pacing mode may be overridden from the environment */
+    const char* mode = getenv("EGLWIDGET_PACING");
+    if( mode != NULL ) pacing = FramePacer::parse(mode, pacing);
+
+    /* Benchmark mode: collect per-phase timings and draw every frame */
+    const char* bench_path = getenv("EGLWIDGET_BENCH");
+    if( bench_path != NULL ) stats = new FrameStats();
+
+    startup.start = FramePacer::now();
+
+    /* Read and decode files on worker threads meanwhile EGL gets initialized */
+    std::vector<std::future<void> > loading;
+    startLoading(loading);
+
+    /* Render scale may be overridden from the environment */
+    const char* scale_env = getenv("EGLWIDGET_RENDER_SCALE");
+    if( scale_env != NULL ) setRenderScale(strtof(scale_env, NULL));
+
+    /* Create EGL surface */
+    createSurface(x, y, width, height);
+    damaged.init(display, width, height);
+    repaint.width = width;
+    repaint.height = height;
+    startup.surface = FramePacer::now();
+
     /* Load shaders */
     loadShaders();
 
+    /* Reduced resolution is rendered offscreen, unless the display scales in hardware */
+#ifndef IS_RPI
+    if( scaled(width) != (int) width || scaled(height) != (int) height ) createOffscreen();
+#endif
+    if( cached ) createLayer();
+    startup.shaders = FramePacer::now();
+
+    /* Wait for all files, rethrow the first error. Every task must finish before we leave */
+    std::exception_ptr loading_error;
+    for( size_t i = 0; i < loading.size(); ++i ) {
+        try {
+            loading[i].get();
+        } catch( ... ) {
+            if( ! loading_error ) loading_error = std::current_exception();
+        }
+    }
+    if( loading_error ) std::rethrow_exception(loading_error);
+    startup.assets = FramePacer::now();
+
     /* Prepare to enter the main loop */
     prepare();
+    startup.prepared = FramePacer::now();
+
+    /* Widgets may have changed GL state bypassing the tracker, e.g. while uploading textures */
+    gl->reset();
+    bind();
+
+    /* Vsync-locked mode relies on eglSwapBuffers() blocking, uncapped mode must never block */
+    if( pacing == FramePacer::PACE_VSYNC ) eglSwapInterval(display, 1);
+    if( pacing == FramePacer::PACE_UNCAPPED ) eglSwapInterval(display, 0);
+
+    FramePacer pacer;
+    pacer.start(pacing, fps);
+
+    /* Optional frame dumps and frame limit, mostly useful with the headless backend */
+    const char* dump_prefix = getenv("EGLWIDGET_DUMP");
+    const char* max_frames_env = getenv("EGLWIDGET_FRAMES");
+    unsigned long max_frames = max_frames_env != NULL ? strtoul(max_frames_env, NULL, 10) : 0;
+    unsigned long drawn = 0;
+
+    /* Frame metrics for monitoring */
+    const char* metrics_path = getenv("EGLWIDGET_METRICS");
+    if( metrics_path != NULL && metrics == NULL ) metrics = new Metrics(metrics_path);
+
+    openLoop();
+
+    /* Threaded mode may be chosen from the environment */
+    const char* threaded_env = getenv("EGLWIDGET_THREADED");
+    if( threaded_env != NULL ) threaded = strcmp(threaded_env, "0") != 0 && *threaded_env != '\0';
+    if( threaded ) startUpdates(&pacer);
+
+    try {
+        while( max_frames == 0 || drawn < max_frames ) {
+            uint64_t now = FramePacer::now();
+
+            /* Loop may never sleep: vsync-locked or uncapped pacing, overrunning frames, busy update thread */
+            if( metrics != NULL ) metrics->serve();
+
+            if( threaded ) {
+                /* Update thread has failed */
+                if( ! updating ) break;
+
+                /* Update thread paces the widget, just wait for its redraw requests */
+                if( ! dirty && stats == NULL ) {
+                    sleepUntil(0);
+                    recordPhase(FrameStats::PHASE_SLEEP, now);
+                    continue;
+                }
+            }
+            else {
+                /* Redraw requests are served at the next frame, otherwise wait for the widget's wakeup time */
+                uint64_t due = (dirty || stats != NULL) ? now : nextWakeup(now);
+                if( due < pacer.getDeadline() ) due = pacer.getDeadline();
+
+                /* Sleep until it's time to update */
+                if( due > now ) {
+                    sleepUntil(due);
+                    recordPhase(FrameStats::PHASE_SLEEP, now);
+                    continue;
+                }
+
+                /* Widget may have been idle for a while, don't count that as missed frames */
+                pacer.resume(now);
+
+                /* Let the widget update its state */
+                update();
+                recordPhase(FrameStats::PHASE_UPDATE, now);
+            }
+
+            /* Benchmark measures the cost of a full frame, whether the widget has changed or not */
+            bool changed = dirty;
+            if( stats != NULL ) dirty = true;
+
+            /* Nothing changed - nothing to draw */
+            if( dirty ) {
+                dirty = false;
+                if( threaded ) resumeUpdates();
+
+                /* Repaint only what has changed since the back buffer was drawn */
+                uint64_t draw_start = FramePacer::now();
+                repaint = damaged.begin(display, surface);
+
+                /* Upscaling pass of the previous frame has changed GL state */
+                if( offscreen.isEnabled() ) {
+                    offscreen.begin(gl);
+                    bind();
+                }
+                setViewport();
+
+                /* Draw one frame */
+                if( layer.isEnabled() ) drawCached(changed);
+                else draw();
+                if( offscreen.isEnabled() ) {
+                    /* Stretch it over the whole surface, alpha channel included */
+                    offscreen.end(NULL);
+                    gl->viewport(0, 0, width, height);
+                    gl->disable(GL_SCISSOR_TEST);
+                    gl->disable(GL_BLEND);
+                    offscreen.draw(gl, layer_program);
+                }
+                frames += 1;
+                recordPhase(FrameStats::PHASE_DRAW, draw_start);
+
+                /* Back buffer content is undefined after the swap, read it now */
+                if( dump_prefix != NULL ) dumpFrame(dump_prefix, drawn);
+                drawn += 1;
+
+                /* Draw image on the screen */
+                uint64_t swap_start = FramePacer::now();
+                damaged.swap(display, surface);
+
+                /* Swapping a pbuffer doesn't wait for rendering, so make sure GPU work gets measured */
+                if( stats != NULL ) glFinish();
+                recordPhase(FrameStats::PHASE_SWAP, swap_start);
+                recordPhase(FrameStats::PHASE_FRAME, now);
+
+                if( drawn == 1 ) reportStartup(FramePacer::now());
+            }
+            else if( metrics != NULL ) metrics->idle += 1;
+
+            /* Schedule the next frame */
+            if( ! threaded ) pacer.frameDone();
+
+            if( metrics != NULL ) {
+                metrics->frames = drawn;
+                if( ! threaded ) metrics->overruns = pacer.getMissed();
+                metrics->gl_issued = gl->getIssued();
+                metrics->gl_elided = gl->getElided();
+            }
+        }
+    } catch( ... ) {
+        /* Update thread must not outlive the main loop */
+        if( threaded ) stopUpdates();
+        throw;
+    }
 
-    /* Given FPS calculate one frame duration */
-    struct timeval tv1, tv2;
-    const double frame_max = 1000000.0 / fps;
-
-    while (1) {
-        /* Frame start time */
-        gettimeofday(&tv1, NULL);
-        double t1 = tv1.tv_sec * 1000000 + tv1.tv_usec;
-
-        /* Draw one frame */
-        draw();
-        frames += 1;
-
-        /* Draw image on the screen, get frame end time */
-        eglSwapBuffers(display, surface);
-        gettimeofday(&tv2, NULL);
+    if( threaded ) {
+        stopUpdates();
+        if( update_error ) std::rethrow_exception(update_error);
+    }
 
-        /* If our frame took less time to draw - sleep the remaining time */
-        double t2 = tv2.tv_sec * 1000000 + tv2.tv_usec;
-        double delta = t2 - t1;
+    /* Save benchmark results */
+    if( stats != NULL ) {
+        stats->write(bench_path, drawn, gl->getIssued(), gl->getElided());
+        printf("Benchmark results: %s\n", bench_path);
 
-        if( delta < frame_max ) usleep(frame_max - delta);
+        delete stats;
+        stats = NULL;
     }
 }
@@ -3,11 +3,26 @@
 
 #include <math.h>
 #include <string>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
 
+#include "pacer.h"
+#include "stats.h"
+#include "metrics.h"
+#include "glstate.h"
+#include "damage.h"
+#include "layer.h"
+#include "shadercache.h"
+
 #ifdef IS_RPI
 #   include <bcm_host.h>
 #else
@@ -19,6 +34,8 @@
 
 /* Base class of a EGL widget */
 class EGLWidget {
+    friend class Compositor;
+
 private:
     /* Native window descriptor */
 #ifdef IS_RPI
@@ -31,13 +48,111 @@ private:
     /* Frame counter shader descriptor */
     GLint u_frames;
 
+    /* Main loop pacing mode */
+    FramePacer::pacing_t pacing;
+
+    /* Threaded mode: update() runs on its own thread */
+    bool threaded;
+    /* Update thread, its wakeup condition and error */
+    std::thread updater;
+    std::mutex update_mutex;
+    std::condition_variable update_cond;
+    std::atomic<bool> updating;
+    std::exception_ptr update_error;
+
+    /* Widget has to be redrawn */
+    std::atomic<bool> dirty;
+    /* Main loop is sleeping and has to be woken up on invalidate() */
+    std::atomic<bool> sleeping;
+
+    /* Main loop descriptors: epoll, wakeup timer, invalidate() event */
+    int epoll_fd;
+    int timer_fd;
+    int wakeup_fd;
+
+    /* Widget which owns our EGL surface when we're hosted by a compositor */
+    EGLWidget* host;
+
+    /* Startup timestamps (FramePacer::now()) for the startup report */
+    typedef struct {
+        uint64_t start;
+        uint64_t surface;
+        uint64_t shaders;
+        uint64_t assets;
+        uint64_t prepared;
+    } startup_t;
+    startup_t startup;
+    /* Time spent in load() on worker threads, including hosted widgets */
+    std::atomic<uint64_t> loading_time;
+
+    /* Frame timings, benchmark mode only */
+    FrameStats* stats;
+    /* Frame metrics served on a Unix socket, if enabled */
+    Metrics* metrics;
+
+    /* GL state of our context. Hosted widgets use their host's one */
+    GLState state;
+
+    /* Changed areas of our surface */
+    Damage damaged;
+
+    /* Buffers cleared by draw(): only those which the chosen EGL config actually has */
+    GLbitfield clear_mask;
+
+    /* Drawing resolution relative to the surface size */
+    float render_scale;
+    /* Offscreen framebuffer for reduced resolution, unless the display scales in hardware */
+    Layer offscreen;
+
+    /* Widget's drawing is cached in a layer, which is redrawn only when the widget changes */
+    bool cached;
+    Layer layer;
+    /* Widget is being drawn into its layer */
+    bool drawing_layer;
+    /* Program drawing layers of this context */
+    Layer::program_t layer_program;
+
     void init();
+    EGLConfig initContext(EGLint surface_type);
     void createSurface(int sx, int sy, int sw, int sh);
+    void createHeadlessSurface(int sx, int sy, int sw, int sh);
+    void attach(EGLWidget* to);
+    void setViewport();
+    void setScissor(const Damage::rect_t& area);
+    int scaled(int value);
+    int viewportWidth();
+    int viewportHeight();
+    void createLayerProgram();
+    const Layer::program_t& layerProgram();
+    Layer* drawTarget();
+    void createLayer();
+    void createOffscreen();
+    void drawCached(bool changed);
     void finish();
 
+    void openLoop();
+    void closeLoop();
+    void sleepUntil(uint64_t time);
+    void requestRedraw();
+    void updateLoop(FramePacer* pacer);
+    void startUpdates(FramePacer* pacer);
+    void resumeUpdates();
+    void stopUpdates();
+    void dumpFrame(const char* prefix, unsigned long index);
+
+    void reportStartup(uint64_t first_frame);
+
+    /* Submit load() of this widget (and hosted ones) to the worker pool */
+    virtual void startLoading(std::vector<std::future<void> >& tasks);
+
+    /* Attribute bindings made by bindAttributes() */
+    std::vector<attribute_binding_t> attributes;
+
     std::string loadFile(const char* file);
-    void loadShaders();
-    GLuint compileShader(GLenum type, const char* file);
+    /* Compile and link shader program (of this widget and hosted ones) */
+    virtual void loadShaders();
+    std::string shaderSource(const char* file, const char* source);
+    GLuint compileShader(GLenum type, const char* name, const std::string& data);
     void setShaderParameters();
 
 protected:
@@ -55,27 +170,95 @@ protected:
     /* Shader program descriptor */
     GLuint program;
 
+    /* GL state tracker. Use it instead of plain GL calls to skip redundant state changes */
+    GLState* gl;
+
+    /* Area being repainted by draw(), in surface coordinates. The rest of the surface
+       still shows the previous frame. Drawing is clipped to it with scissor test */
+    Damage::rect_t repaint;
+
     /* EGL specific descriptors */
     EGLDisplay display;
     EGLContext context;
     EGLSurface surface;
 
+    /* Record duration of a frame phase which started at 'start' (FramePacer::now() time).
+       Does nothing unless running in benchmark mode or serving metrics */
+    void recordPhase(FrameStats::phase_t phase, uint64_t start);
+
+    /* Cache part of draw(), e.g. a static background, in a layer of the widget's size:
+
+           if( beginLayer(background) ) {
+               ... draw calls ...
+               endLayer(background);
+           }
+           drawLayer(background);
+
+       beginLayer() returns false while the layer holds what has been drawn last time, otherwise drawing
+       goes into the layer, cleared to transparent black, until endLayer(). Call background.invalidate()
+       when it has to be drawn again. The widget owns its layers */
+    bool beginLayer(Layer& target);
+    void endLayer(Layer& target);
+    /* Blend layer over the widget as premultiplied alpha. Restores widget's GL state with bind(),
+       blending is disabled before */
+    void drawLayer(Layer& target);
+
 protected:
+    /* Framebuffer requirements: minimal sizes in bits, zero means not needed */
+    typedef struct {
+        EGLint red;
+        EGLint green;
+        EGLint blue;
+        EGLint alpha;
+        EGLint depth;
+        EGLint stencil;
+        /* Multisampling, samples per pixel */
+        EGLint samples;
+    } framebuffer_t;
+
     /* Virtual functions to be overloaded in the subclass: */
 
-    /* Called before main loop. Initialize your widget here */
+    /* Called on a worker thread while EGL is being initialized. Read and decode your files here.
+       No GL calls: the context isn't ready yet and belongs to another thread */
+    virtual void load();
+    /* Called before the shader program gets linked. Call bindAttribute() here */
+    virtual void bindAttributes();
+    /* Called before main loop, after load() is done. Upload your data to GL here */
     virtual void prepare();
+    /* Called before drawing when GL state may have been changed by other widgets sharing the
+       same context. Bind your buffers, textures and vertex attributes here */
+    virtual void bind();
+    /* Called when the widget wakes up. Update your widget's state here and call invalidate()
+       if it has to be redrawn. Default implementation redraws on every frame */
+    virtual void update();
+    /* Called to get the absolute CLOCK_MONOTONIC time (nanoseconds) of the next update.
+       Default implementation wants to be updated as soon as the pacing allows */
+    virtual uint64_t nextWakeup(uint64_t now);
     /* Called in the main loop to draw one frame */
     virtual void draw();
     /* Called to get path to your widget's vertex shader file */
     virtual const char* vertexShader();
     /* Called to get path to your widget's pixel shader file */
     virtual const char* fragmentShader();
+    /* Called to get your widget's vertex shader source, e.g. embedded from a generated
+       shaders/<name>.h header.
+       Overrides the shader file unless EGLWIDGET_SHADER_FILES is set.
+       NULL here and in vertexShader() means no shader program */
+    virtual const char* vertexShaderSource();
+    /* Called to get your widget's pixel shader source */
+    virtual const char* fragmentShaderSource();
+    /* Called to get framebuffer requirements. The cheapest EGL config meeting them is chosen.
+       Default is 8-bit RGBA without depth and stencil buffers */
+    virtual framebuffer_t framebuffer();
 
 public:
+    /* EGL surface is created by run(), unless the widget is hosted by a compositor */
     EGLWidget(int sx, int sy, int sw, int sh) {
         init();
-        createSurface(sx, sy, sw, sh);
+        x = sx;
+        y = sy;
+        width = sw;
+        height = sh;
     }
 
     virtual ~EGLWidget() {
@@ -85,6 +268,34 @@ public:
     uint32_t getWidth()  { return width; }
     uint32_t getHeight() { return height; }
 
+    /* Choose how the main loop waits for the next frame. May be overridden
+       with EGLWIDGET_PACING environment variable: "fixed", "vsync" or "uncapped" */
+    void setPacing(FramePacer::pacing_t mode) { pacing = mode; }
+
+    /* Run update() on a separate thread, so that slow updates don't delay drawing.
+       Widget's update() and draw() must then exchange state through a TripleBuffer.
+       May be overridden with EGLWIDGET_THREADED environment variable: "1" or "0" */
+    void setThreaded(bool on) { threaded = on; }
+
+    /* Draw at a fraction of the surface resolution (0.1 .. 1) and stretch the result over the surface.
+       May be overridden with EGLWIDGET_RENDER_SCALE environment variable */
+    void setRenderScale(float scale);
+
+    /* Cache widget's drawing in a texture layer. Widget is then drawn only when it has changed, frames
+       drawn meanwhile show the cached texture with one quad: those of its compositor when the widget is
+       hosted, benchmark frames when it runs standalone */
+    void setCached(bool on) { cached = on; }
+
+    /* Bind vertex attribute 'name' to location 'index'. Call it from bindAttributes(): unlike plain
+       glBindAttribLocation() the binding becomes part of the shader cache key */
+    void bindAttribute(GLuint index, const char* name);
+
+    /* Request a redraw. May be called from any thread */
+    void invalidate();
+    /* Request a redraw of the given area only (widget coordinates, origin at the top left corner).
+       May be called from any thread */
+    void damage(int dx, int dy, int dw, int dh);
+
     /* Run main loop at given FPS */
     void run(int fps);
 };
@@ -0,0 +1,63 @@
+#include <memory>
+
+#include "workers.h"
+
+/* Start worker threads */
+WorkerPool::WorkerPool(unsigned count) {
+    stopping = false;
+
+    if( count == 0 ) count = std::thread::hardware_concurrency();
+    if( count == 0 ) count = 1;
+
+    for( unsigned i = 0; i < count; ++i )
+        threads.push_back(std::thread(&WorkerPool::work, this));
+}
+
+/* Finish queued tasks and stop worker threads */
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    cond.notify_all();
+
+    for( size_t i = 0; i < threads.size(); ++i )
+        threads[i].join();
+}
+
+/* Worker thread */
+void WorkerPool::work() {
+    for( ;; ) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [this] { return stopping || ! tasks.empty(); });
+            if( tasks.empty() ) return;
+
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+/* Queue a task */
+std::future<void> WorkerPool::submit(std::function<void()> task) {
+    /* std::function needs a copyable callable */
+    std::shared_ptr<std::packaged_task<void()> > packaged = std::make_shared<std::packaged_task<void()> >(task);
+    std::future<void> result = packaged->get_future();
+
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        tasks.push_back([packaged] { (*packaged)(); });
+    }
+    cond.notify_one();
+
+    return result;
+}
+
+/* Pool shared by all widgets, created on first use */
+WorkerPool& WorkerPool::shared() {
+    static WorkerPool pool;
+    return pool;
+}
@@ -0,0 +1,38 @@
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fixed pool of worker threads for CPU work like file reading and image decoding.
+   Tasks must never wait for other tasks of the same pool */
+class WorkerPool {
+private:
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()> > tasks;
+    std::mutex lock;
+    std::condition_variable cond;
+    bool stopping;
+
+    void work();
+
+public:
+    /* Zero means one thread per CPU core */
+    WorkerPool(unsigned count = 0);
+    ~WorkerPool();
+
+    /* Run task on a worker thread. Exceptions are rethrown by the future's get() */
+    std::future<void> submit(std::function<void()> task);
+
+    unsigned size() { return threads.size(); }
+
+    /* Pool shared by all widgets of the process */
+    static WorkerPool& shared();
+};
+
+#endif